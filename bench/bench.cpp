@@ -0,0 +1,341 @@
+/*
+ *
+ * CHIPIT
+ *
+ * Benchmarks. Build and run them with `make bench`, or run
+ * bin/release/chipit-bench [NAME...] to only run the benchmarks whose name
+ * starts with one of the given prefixes.
+ *
+ * The output is meant to be kept and compared across commits. Every result is
+ * one line:
+ *   <name> <value> <unit>
+ * where the unit is either a rate (.../s, higher is better) or a cost per call
+ * (ns, lower is better). Lines starting with # are comments.
+ *
+ * Every result is the best of several runs, each long enough to make the
+ * timer resolution irrelevant.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "machine.h"
+#include "disasm.h"
+#include "display.h"
+#include "version.h"
+
+static std::vector<std::string> filters;
+
+static bool selected(const std::string &name)
+{
+    if (filters.empty())
+        return true;
+    for (const std::string &f : filters)
+        if (name.compare(0, f.size(), f) == 0)
+            return true;
+    return false;
+}
+
+static void report(const std::string &name, double value, const char *unit)
+{
+    printf("%-24s %16.1f %s\n", name.c_str(), value, unit);
+    fflush(stdout);
+}
+
+// Seconds per iteration of run(n), which must do n iterations. n is doubled
+// until a run takes long enough, then the best of a few runs is taken.
+static double measure(const std::function<void(u64)> &run)
+{
+    typedef std::chrono::steady_clock clock;
+    auto timeRun = [&](u64 n) {
+        clock::time_point begin = clock::now();
+        run(n);
+        return std::chrono::duration<double>(clock::now() - begin).count();
+    };
+
+    u64 n = 1;
+    double t;
+    while ((t = timeRun(n)) < 0.02)
+        n *= 2;
+
+    double best = t / n;
+    for (int i = 0; i < 4; i++) {
+        t = timeRun(n) / n;
+        if (t < best)
+            best = t;
+    }
+    return best;
+}
+
+// Deterministic filler, so every run benchmarks the same code
+static u32 fill = 0x9E3779B9;
+static u32 nextFill()
+{
+    fill ^= fill << 13;
+    fill ^= fill >> 17;
+    fill ^= fill << 5;
+    return fill;
+}
+
+/*
+ * Instructions per second of one opcode class through executeOpcode()
+ * (opcode.*) and through the dispatch table (table.*).
+ *
+ * RAM from 0x200 is filled with instructions of the class. The program ends
+ * with LD VE, 00 (so a skip can't jump over the end) and JP 0x200. make()
+ * gets the address of every instruction and its index, so it can vary the
+ * registers used and keep jumps going forward.
+ */
+struct OpcodeClass {
+    const char *name;
+    std::function<u16(u16 addr, int i)> make;
+};
+
+static void benchOpcode(const OpcodeClass &c, bool table)
+{
+    std::string name = std::string(table ? "table." : "opcode.") + c.name;
+    if (!selected(name))
+        return;
+
+    std::unique_ptr<Machine> m(new Machine);
+    m->engine = Engine::Switch;
+    m->reset();
+
+    int i = 0;
+    for (u16 addr = 0x200; addr < 0xFFC; addr += 2, i++) {
+        u16 op = c.make(addr, i);
+        m->ram[addr] = op >> 8;
+        m->ram[addr + 1] = op & 0xFF;
+    }
+    m->ram[0xFFC] = 0x6E; m->ram[0xFFD] = 0x00;
+    m->ram[0xFFE] = 0x12; m->ram[0xFFF] = 0x00;
+
+    // Half of the registers are 0, half are 1, so half of the skips are taken.
+    // V0 is 0 for Bnnn. I points below the program for Fx33 and Fx55.
+    for (int r = 0; r < 16; r++)
+        m->v[r] = r & 1;
+    m->I = 0x100;
+    // Return to 0x200 from anywhere, for 00EE
+    for (int s = 0; s < 16; s++)
+        m->stack[s] = 0x1FE;
+
+    double t = measure([&](u64 n) {
+        if (table) {
+            for (u64 k = 0; k < n; k++)
+                m->pc += m->executeTable();
+        } else {
+            for (u64 k = 0; k < n; k++)
+                m->pc += m->executeOpcode();
+        }
+    });
+    report(name, 1 / t, "instr/s");
+}
+
+static void benchOpcodes()
+{
+    static const u8 alu[] = { 0x0, 0x1, 0x2, 0x3, 0x4, 0x5, 0x6, 0x7, 0xE };
+    const OpcodeClass classes[] = {
+        { "00E0", [](u16, int)        { return 0x00E0; } },
+        { "00EE", [](u16, int)        { return 0x00EE; } },
+        // The scrolls move the whole screen, whatever is on it
+        { "00Cn", [](u16, int i)      { return 0x00C0 | (i % 15 + 1); } },
+        { "00FB", [](u16, int i)      { return i & 1 ? 0x00FB : 0x00FC; } },
+        { "1nnn", [](u16 a, int)      { return 0x1000 | (a + 2); } },
+        { "2nnn", [](u16 a, int)      { return 0x2000 | (a + 2); } },
+        { "3xkk", [](u16, int i)      { return 0x3000 | (i & 0xF) << 8; } },
+        { "4xkk", [](u16, int i)      { return 0x4000 | (i & 0xF) << 8; } },
+        { "5xy0", [](u16, int i)      { return 0x5000 | (i & 0xF) << 8 | (i >> 4 & 0xF) << 4; } },
+        { "6xkk", [](u16, int i)      { return 0x6000 | (i % 15) << 8 | (i & 0xFF); } },
+        { "7xkk", [](u16, int i)      { return 0x7000 | (i % 15) << 8 | (i & 0xFF); } },
+        { "8xyn", [](u16, int i)      { return 0x8000 | (i % 15) << 8 | (i / 3 % 15) << 4 | alu[i % 9]; } },
+        { "9xy0", [](u16, int i)      { return 0x9000 | (i & 0xF) << 8 | (i >> 4 & 0xF) << 4; } },
+        { "Annn", [](u16, int i)      { return 0xA000 | (i & 0xFFF); } },
+        { "Bnnn", [](u16 a, int)      { return 0xB000 | (a + 2); } },
+        { "Cxkk", [](u16, int i)      { return 0xC000 | (i % 15) << 8 | 0xFF; } },
+        { "Dxyn", [](u16, int i)      { return 0xD000 | (i & 0xF) << 8 | (i >> 4 & 0xF) << 4 | (i % 15 + 1); } },
+        { "Dxy0", [](u16, int i)      { return 0xD000 | (i & 0xF) << 8 | (i >> 4 & 0xF) << 4; } },
+        { "Exkk", [](u16, int i)      { return (i & 1 ? 0xE09E : 0xE0A1) | (i & 0xF) << 8; } },
+        { "Fx07", [](u16, int i)      { return 0xF007 | (i % 15) << 8; } },
+        { "Fx15", [](u16, int i)      { return (i & 1 ? 0xF015 : 0xF018) | (i & 0xF) << 8; } },
+        { "Fx1E", [](u16, int i)      { return 0xF01E | (i & 0xF) << 8; } },
+        { "Fx29", [](u16, int i)      { return 0xF029 | (i & 0xF) << 8; } },
+        { "Fx33", [](u16, int i)      { return 0xF033 | (i & 0xF) << 8; } },
+        // Fx55 and Fx65 move I along, so every other instruction puts it back
+        { "Fx55", [](u16, int i)      { return i & 1 ? 0xF055 | (i >> 1 & 0xF) << 8 : 0xA100; } },
+        { "Fx65", [](u16, int i)      { return i & 1 ? 0xF065 | (i >> 1 & 0xF) << 8 : 0xA100; } },
+    };
+
+    for (const OpcodeClass &c : classes)
+        benchOpcode(c, false);
+    for (const OpcodeClass &c : classes)
+        benchOpcode(c, true);
+}
+
+// drawSprite() by sprite height (16x16 for Dxy0), at a position aligned to
+// the row words, at one that isn't, and at one where the sprite wraps around
+// both edges, in low and in high resolution
+static void benchDrawSprite()
+{
+    struct Position {
+        const char *name;
+        bool hires;
+        u8 x, y;
+    };
+    const Position positions[] = {
+        { "aligned", false, 0, 0 },
+        { "unaligned", false, 13, 5 },
+        { "wrapped", false, 60, 28 },
+        { "hires.unaligned", true, 77, 21 },
+        { "hires.wrapped", true, 124, 60 },
+    };
+
+    std::unique_ptr<Machine> m(new Machine);
+    m->reset();
+    m->I = 0x200;
+    for (int i = 0; i < 32; i++)
+        m->ram[0x200 + i] = nextFill();
+
+    for (const Position &p : positions) {
+        for (int h = 0; h <= 15; h++) {
+            std::string name = "sprite." + std::string(p.name) + "." + (h ? std::to_string(h) : "16x16");
+            if (!selected(name))
+                continue;
+
+            m->setHires(p.hires);
+            m->v[0] = p.x;
+            m->v[1] = p.y;
+            double t = measure([&](u64 n) {
+                for (u64 k = 0; k < n; k++)
+                    m->drawSprite(0, 1, h);
+            });
+            report(name, t * 1e9, "ns");
+        }
+    }
+}
+
+// Disassembling a full 3.5 KB program, from scratch, once all lines have
+// been formatted and as a listing
+static void benchDisassemble()
+{
+    if (!selected("disasm"))
+        return;
+
+    std::unique_ptr<Machine> m(new Machine);
+    m->reset();
+    for (int a = 0x200; a < 0x1000; a++)
+        m->ram[a] = nextFill();
+
+    std::unique_ptr<Disassembly> d(new Disassembly);
+    const int instructions = (0x1000 - 0x200) / 2;
+    double t = measure([&](u64 n) {
+        for (u64 k = 0; k < n; k++) {
+            d->clear();
+            for (int a = 0x200; a < 0x1000; a += 2)
+                d->line(*m, a);
+        }
+    });
+    report("disasm.rom", t * 1e9, "ns");
+    report("disasm.rate", instructions / t, "instr/s");
+
+    t = measure([&](u64 n) {
+        for (u64 k = 0; k < n; k++)
+            for (int a = 0x200; a < 0x1000; a += 2)
+                d->line(*m, a);
+    });
+    report("disasm.cached", t * 1e9, "ns");
+
+    // Flow analysis and a full listing, as -d does
+    t = measure([&](u64 n) {
+        for (u64 k = 0; k < n; k++) {
+            CodeMap map;
+            std::string listing;
+            analyzeFlow(m->ram, 0x1000, map);
+            listProgram(m->ram, map, listing);
+        }
+    });
+    report("disasm.listing", t * 1e9, "ns");
+}
+
+// updateDisplay() and drawDisplay() into an off screen target: redrawing
+// everything, a typical frame (a sprite moved, PC and a register changed)
+// and a frame where nothing changed, which isn't drawn at all
+static void benchDisplay()
+{
+    if (!selected("display"))
+        return;
+
+    sf::RenderTexture target;
+    if (!initDisplay() || !target.create(screenWidth, screenHeight)) {
+        printf("# display: couldn't create the textures or load the font, skipped\n");
+        return;
+    }
+
+    std::unique_ptr<Machine> m(new Machine);
+    m->reset();
+    for (int a = 0x200; a < 0x1000; a++)
+        m->ram[a] = nextFill();
+    disasm.clear();
+    for (int r = 0; r < Framebuffer::height; r++) {
+        m->display.left[0][r] = (u64)nextFill() << 32 | nextFill();
+        m->display.right[0][r] = (u64)nextFill() << 32 | nextFill();
+    }
+    updateDisplay(*m, ~0ull);
+
+    if (selected("display.full")) {
+        double t = measure([&](u64 n) {
+            for (u64 k = 0; k < n; k++) {
+                invalidateDisplay();
+                updateDisplay(*m, 0);
+                target.clear(sf::Color::Black);
+                drawDisplay(target);
+                target.display();
+            }
+        });
+        report("display.full", t * 1e9, "ns");
+    }
+
+    if (selected("display.typical")) {
+        m->I = 0x200;
+        double t = measure([&](u64 n) {
+            for (u64 k = 0; k < n; k++) {
+                m->drawSprite(0, 1, 8);
+                m->v[0] += 1;
+                m->pc = m->pc < 0xFFE ? m->pc + 2 : 0x200;
+                updateDisplay(*m, m->dirtyRows);
+                m->dirtyRows = 0;
+                target.clear(sf::Color::Black);
+                drawDisplay(target);
+                target.display();
+            }
+        });
+        report("display.typical", t * 1e9, "ns");
+    }
+
+    if (selected("display.idle")) {
+        updateDisplay(*m, 0);
+        double t = measure([&](u64 n) {
+            for (u64 k = 0; k < n; k++)
+                updateDisplay(*m, 0);
+        });
+        report("display.idle", t * 1e9, "ns");
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    for (int i = 1; i < argc; i++)
+        filters.push_back(argv[i]);
+
+    printf("# chipit-bench %s\n", VERSION_STRING);
+    printf("# name value unit\n");
+
+    benchOpcodes();
+    benchDrawSprite();
+    benchDisassemble();
+    benchDisplay();
+    return 0;
+}
@@ -0,0 +1,359 @@
+/*
+ *
+ * CHIPIT
+ *
+ * Ahead-of-time translation to C++. See aot.h.
+ */
+
+#include <stdio.h>
+#include <stdarg.h>
+
+#include "aot.h"
+#include "disasm.h"
+
+const AotProgram *aotProgram = nullptr;
+
+// Instructions the translated code leaves to the interpreter
+static bool interpreted(u16 opcode)
+{
+    if ((opcode >> 12) == 0xB || opcode == 0x00FD)
+        return true;
+    if ((opcode >> 12) != 0xF)
+        return false;
+    switch (opcode & 0xFF) {
+        case 0x07: case 0x0A: case 0x15: case 0x18:
+            return true;
+    }
+    return false;
+}
+
+// Does this instruction end a block? Anything that doesn't simply go on with
+// the next instruction, and RAM writes, after which the code may be stale.
+static bool endsBlock(u16 opcode)
+{
+    switch (opcode >> 12) {
+        case 0x0:
+            return opcode == 0x00EE;
+        case 0x1: case 0x2: case 0x3: case 0x4:
+        case 0x5: case 0x9: case 0xE:
+            return true;
+        case 0xF:
+            return (opcode & 0xFF) == 0x33 || (opcode & 0xFF) == 0x55;
+        default:
+            return false;
+    }
+}
+
+class Translator {
+    public:
+        Translator(const u8 *ram, const CodeMap &map, Quirks quirks, std::string &out)
+            : ram(ram), map(map), quirks(quirks), flags(quirkFlags(quirks)), out(out) {}
+
+        void run(const char *name);
+
+    private:
+        void emit(const char *format, ...) __attribute__((format(printf, 2, 3)));
+        u16 opcodeAt(u16 a) const { return ram[a] << 8 | ram[a + 1]; }
+        bool isEntry(u16 a) const { return a >= map.start && a + 1 < map.end && entries[a]; }
+        void jump(u16 target);
+        void block(u16 start);
+        void instruction(u16 a, u16 opcode);
+
+        const u8 *ram;
+        const CodeMap &map;
+        Quirks quirks;
+        QuirkFlags flags;
+        std::string &out;
+
+        // Where the translated code can be entered: block leaders, and the
+        // instructions after anything that leaves it
+        std::bitset<4096> entries;
+};
+
+void Translator::emit(const char *format, ...)
+{
+    char line[256];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(line, sizeof(line), format, args);
+    va_end(args);
+    out += line;
+}
+
+// Go on at target, in translated code if there is some
+void Translator::jump(u16 target)
+{
+    if (isEntry(target))
+        emit("goto L_%03X;\n", target);
+    else
+        emit("{ pc = 0x%03X; goto out; }\n", target);
+}
+
+void Translator::block(u16 start)
+{
+    // Straight-line code up to the next entry, the end of the block or an
+    // instruction for the interpreter
+    int length = 0;
+    u16 a = start;
+    while (a + 1 < map.end && map.code[a]) {
+        u16 opcode = opcodeAt(a);
+        if (interpreted(opcode) || (a != start && entries[a]))
+            break;
+        length++;
+        a += 2;
+        if (endsBlock(opcode))
+            break;
+    }
+
+    emit("L_%03X:\n", start);
+    if (!length) {
+        emit("    pc = 0x%03X; goto out;\n", start);
+        return;
+    }
+    emit("    if (left < %d) { pc = 0x%03X; goto out; }\n", length, start);
+    emit("    left -= %d;\n", length);
+
+    u16 last = start + 2 * (length - 1);
+    for (u16 i = start; i <= last; i += 2)
+        instruction(i, opcodeAt(i));
+    if (!endsBlock(opcodeAt(last))) {
+        emit("    ");
+        jump(last + 2);
+    }
+}
+
+void Translator::instruction(u16 a, u16 opcode)
+{
+    unsigned x = (opcode >> 8) & 0xF, y = (opcode >> 4) & 0xF, n = opcode & 0xF;
+    unsigned kk = opcode & 0xFF, nnn = opcode & 0xFFF;
+
+    emit("    // ");
+    char text[disasmLineSize];
+    emit("%s\n", formatInstruction(a, opcode, text));
+    emit("    ");
+
+    switch (opcode >> 12) {
+        case 0x0:
+            if (opcode == 0x00E0)
+                emit("m.clearDisplay();\n");
+            else if ((opcode & 0xFFF0) == 0x00C0)
+                emit("m.scrollDown(%u);\n", n);
+            else if ((opcode & 0xFFF0) == 0x00D0)
+                emit("m.scrollUp(%u);\n", n);
+            else if (opcode == 0x00FB)
+                emit("m.scrollRight();\n");
+            else if (opcode == 0x00FC)
+                emit("m.scrollLeft();\n");
+            else if (opcode == 0x00FE || opcode == 0x00FF)
+                emit("m.setHires(%s);\n", opcode == 0x00FF ? "true" : "false");
+            else if (opcode == 0x00EE)
+                emit("m.stackptr = (m.stackptr - 1) & 0xF; pc = m.stack[m.stackptr] + 2; goto dispatch;\n");
+            else
+                emit(";\n");
+            break;
+        case 0x1:
+            jump(nnn);
+            break;
+        case 0x2:
+            emit("m.stack[m.stackptr] = 0x%03X; m.stackptr = (m.stackptr + 1) & 0xF; ", a);
+            jump(nnn);
+            break;
+        case 0x3:
+            emit("if (v%X == 0x%02X) ", x, kk); jump(a + 4); emit("    "); jump(a + 2);
+            break;
+        case 0x4:
+            emit("if (v%X != 0x%02X) ", x, kk); jump(a + 4); emit("    "); jump(a + 2);
+            break;
+        case 0x5:
+            emit("if (v%X == v%X) ", x, y); jump(a + 4); emit("    "); jump(a + 2);
+            break;
+        case 0x6:
+            emit("v%X = 0x%02X;\n", x, kk);
+            break;
+        case 0x7:
+            emit("v%X += 0x%02X;\n", x, kk);
+            break;
+        case 0x8:
+            switch (n) {
+                case 0x0: emit("v%X = v%X;\n", x, y); break;
+                case 0x1: emit("v%X |= v%X;\n", x, y); break;
+                case 0x2: emit("v%X &= v%X;\n", x, y); break;
+                case 0x3: emit("v%X ^= v%X;\n", x, y); break;
+                case 0x4: emit("vF = (v%X + v%X) > 0xFF; v%X += v%X;\n", x, y, x, y); break;
+                case 0x5: emit("vF = v%X > v%X; v%X -= v%X;\n", x, y, x, y); break;
+                case 0x6:
+                    if (flags.shiftVy)
+                        emit("vF = v%X & 1; v%X = v%X >> 1;\n", y, x, y);
+                    else
+                        emit("vF = v%X & 1; v%X >>= 1;\n", x, x);
+                    break;
+                case 0x7: emit("vF = !(v%X > v%X); v%X = v%X - v%X;\n", x, y, x, y, x); break;
+                case 0xE:
+                    if (flags.shiftVy)
+                        emit("vF = v%X >> 7; v%X = v%X << 1;\n", y, x, y);
+                    else
+                        emit("vF = v%X >> 7; v%X <<= 1;\n", x, x);
+                    break;
+                default: emit(";\n"); break;
+            }
+            break;
+        case 0x9:
+            emit("if (v%X != v%X) ", x, y); jump(a + 4); emit("    "); jump(a + 2);
+            break;
+        case 0xA:
+            emit("I = 0x%03X;\n", nnn);
+            break;
+        case 0xC:
+            emit("v%X = m.nextRandom() %% %u;\n", x, kk + 1);
+            break;
+        case 0xD:
+            // drawSprite() works on the machine's registers
+            emit("m.v[0x%X] = v%X; m.v[0x%X] = v%X; m.I = I; m.drawSprite<%s>(0x%X, 0x%X, %u); vF = m.v[0xF];\n",
+                    x, x, y, y, quirksPolicy(quirks), x, y, n);
+            break;
+        case 0xE:
+            if (kk == 0x9E)
+                emit("if (m.key[v%X & 0xF]) ", x);
+            else if (kk == 0xA1)
+                emit("if (!m.key[v%X & 0xF]) ", x);
+            if (kk == 0x9E || kk == 0xA1) {
+                jump(a + 4);
+                emit("    ");
+            }
+            jump(a + 2);
+            break;
+        case 0xF:
+            switch (kk) {
+                case 0x01:
+                    emit("m.display.planes = %u;\n", x & 3);
+                    break;
+                case 0x1E:
+                    emit("I += v%X;\n", x);
+                    break;
+                case 0x29:
+                    emit("I = v%X * 5;\n", x);
+                    break;
+                case 0x30:
+                    emit("I = 0x%03X + (v%X & 0xF) * 10;\n", bigFontAddr, x);
+                    break;
+                case 0x33:
+                    emit("m.writeRam(I, v%X / 100); m.writeRam(I + 1, (v%X / 10) %% 10); m.writeRam(I + 2, v%X %% 10);\n", x, x, x);
+                    break;
+                case 0x55:
+                    for (unsigned r = 0; r <= x; r++)
+                        emit("%sm.writeRam(I + %u, v%X);\n", r ? "    " : "", r, r);
+                    if (!flags.keepI)
+                        emit("    I += %u;\n", x + 1);
+                    break;
+                case 0x65:
+                    for (unsigned r = 0; r <= x; r++)
+                        emit("%sv%X = m.ram[(I + %u) & 0xFFF];\n", r ? "    " : "", r, r);
+                    if (!flags.keepI)
+                        emit("    I += %u;\n", x + 1);
+                    break;
+                case 0x75:
+                    for (unsigned r = 0; r <= x; r++)
+                        emit("%sm.flags[%u] = v%X;\n", r ? "    " : "", r, r);
+                    break;
+                case 0x85:
+                    for (unsigned r = 0; r <= x; r++)
+                        emit("%sv%X = m.flags[%u];\n", r ? "    " : "", r, r);
+                    break;
+                default:
+                    emit(";\n");
+                    break;
+            }
+            if (kk == 0x33 || kk == 0x55) {
+                // The program may have just changed its own code
+                emit("    if (!m.aotValid) { pc = 0x%03X; goto out; }\n", a + 2);
+                emit("    ");
+                jump(a + 2);
+            }
+            break;
+    }
+}
+
+void Translator::run(const char *name)
+{
+    // Every leader is an entry, and so is whatever comes after an
+    // instruction that leaves the translated code
+    entries = map.leaders;
+    bool returns = false;
+    for (int a = map.start; a + 1 < map.end; a++) {
+        if (!map.code[a])
+            continue;
+        u16 opcode = opcodeAt(a);
+        returns |= opcode == 0x00EE;
+        if ((interpreted(opcode) || endsBlock(opcode)) && a + 3 < map.end && map.code[a + 2])
+            entries[a + 2] = true;
+        if (interpreted(opcode))
+            entries[a] = false;
+    }
+    for (int a = 0; a < 4096; a++) {
+        if (!map.code[a])
+            entries[a] = false;
+    }
+
+    emit("/*\n * %s, translated by chipit --aot. Build it into a chipit of its own with\n", name);
+    emit(" *   make aot AOT_SOURCE=<this file>\n */\n\n");
+    emit("#include \"aot.h\"\n\n");
+
+    emit("static const u8 rom[] = {");
+    for (int a = map.start; a < map.end; a++)
+        emit("%s0x%02X,", (a - map.start) % 16 ? " " : "\n    ", ram[a]);
+    emit("\n};\n\n");
+
+    emit("static const u8 covered[512] = {");
+    for (int i = 0; i < 512; i++) {
+        u8 bits = 0;
+        for (int b = 0; b < 8; b++)
+            bits |= map.covered[i * 8 + b] << b;
+        emit("%s0x%02X,", i % 16 ? " " : "\n    ", bits);
+    }
+    emit("\n};\n\n");
+
+    emit("static i64 run(Machine &m, i64 budget)\n{\n");
+    emit("    u8 ");
+    for (int r = 0; r < 16; r++)
+        emit("v%X = m.v[0x%X]%s", r, r, r < 15 ? ", " : ";\n");
+    emit("    u16 I = m.I;\n");
+    emit("    u16 pc = m.pc;\n");
+    emit("    i64 left = budget;\n\n");
+
+    // Returns come back through here
+    if (returns)
+        emit("dispatch:\n");
+    emit("    switch (pc) {\n");
+    for (int a = 0; a < 4096; a++) {
+        if (entries[a])
+            emit("        case 0x%03X: goto L_%03X;\n", a, a);
+    }
+    emit("        default: goto out;\n    }\n\n");
+
+    for (int a = map.start; a < map.end; a++) {
+        if (entries[a])
+            block(a);
+    }
+
+    emit("\nout:\n");
+    for (int r = 0; r < 16; r++)
+        emit("    m.v[0x%X] = v%X;\n", r, r);
+    emit("    m.I = I;\n");
+    emit("    m.pc = pc;\n");
+    emit("    return budget - left;\n}\n\n");
+
+    emit("static const AotProgram program = { \"%s\", rom, sizeof(rom), %s::id, covered, run };\n\n",
+            name, quirksPolicy(quirks));
+    emit("static struct Register {\n    Register() { aotProgram = &program; }\n} registration;\n");
+}
+
+void translateProgram(const u8 *ram, const CodeMap &map, const char *name, Quirks quirks, std::string &out)
+{
+    // The name goes in a comment and a string, keep it harmless in both
+    std::string safe(name);
+    for (char &c : safe) {
+        if (c == '"' || c == '\\' || c == '*' || (unsigned char)c < ' ')
+            c = '_';
+    }
+    Translator(ram, map, quirks, out).run(safe.c_str());
+}
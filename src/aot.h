@@ -0,0 +1,53 @@
+/*
+ *
+ * CHIPIT
+ *
+ * Ahead-of-time translation of a program to C++ (--aot).
+ *
+ * translateProgram() turns the code found by the control flow analysis (see
+ * flow.h) into a C++ function with a label per basic block. V0 - VF and I are
+ * kept in locals, PC only exists at block boundaries, and every block takes
+ * its length from the instruction budget first, like the JIT does. The file
+ * also holds the program image and registers itself as aotProgram, so
+ * building it with the rest of the emulator (make aot AOT_SOURCE=FILE) gives
+ * a chipit that runs that program natively with the aot engine, with the
+ * usual display, timers and input. The code is generated for one quirk
+ * profile, and only runs on a machine with the same quirks.
+ *
+ * The translated code leaves to the interpreter whatever it can't do on its
+ * own: Bnnn (whose target isn't known), Fx0A and the timer instructions
+ * (which must see the timer ticks of the frames before them, see
+ * Machine::runCycles()), and any address it wasn't translated for. As soon as
+ * the program writes to its own code the translation is no longer used.
+ */
+
+#ifndef AOT_H
+#define AOT_H
+
+#include <string>
+
+#include "machine.h"
+#include "flow.h"
+
+// Translated code. Runs at most budget instructions from m.pc and returns how
+// many it ran; 0 if there's no translated code at m.pc or the budget doesn't
+// cover its first block.
+typedef i64 (*AotFn)(Machine &m, i64 budget);
+
+struct AotProgram {
+    const char *name;        // file the program was translated from
+    const u8 *rom;           // the program, loaded at 0x200
+    u16 size;
+    Quirks quirks;           // profile it was translated for
+    const u8 *covered;       // translated bytes, bit (a & 7) of covered[a >> 3]
+    AotFn run;
+};
+
+// The program linked into this binary, if any. Set by the translated file.
+extern const AotProgram *aotProgram;
+
+// Write C++ source for the program in ram[map.start] - ram[map.end - 1],
+// behaving as the given quirks say
+void translateProgram(const u8 *ram, const CodeMap &map, const char *name, Quirks quirks, std::string &out);
+
+#endif
@@ -0,0 +1,141 @@
+/*
+ *
+ * CHIPIT
+ *
+ * Batch mode. See batch.h.
+ */
+
+#include <stdio.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <chrono>
+
+#include "batch.h"
+#include "pool.h"
+#include "flow.h"
+#include "disasm.h"
+
+bool listRoms(const std::string &dir, std::vector<std::string> &names)
+{
+    DIR *d = opendir(dir.c_str());
+    if (!d)
+        return false;
+
+    while (struct dirent *e = readdir(d)) {
+        std::string path = dir + "/" + e->d_name;
+        struct stat st;
+        if (stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode))
+            names.push_back(e->d_name);
+    }
+    closedir(d);
+
+    std::sort(names.begin(), names.end());
+    return true;
+}
+
+u64 hashDisplay(const Machine &m)
+{
+    u64 h = 0xcbf29ce484222325ull;
+    for (int p = 0; p < Framebuffer::planeCount; p++) {
+        for (int y = 0; y < Framebuffer::height; y++) {
+            for (u64 word : { m.display.left[p][y], m.display.right[p][y] }) {
+                for (int i = 0; i < 8; i++, word >>= 8) {
+                    h ^= word & 0xFF;
+                    h *= 0x100000001b3ull;
+                }
+            }
+        }
+    }
+    return h;
+}
+
+// Run one ROM in a machine of its own
+static void runOne(const std::string &path, const BatchOptions &options, BatchResult &r)
+{
+    // Machines are big, keep them off the worker's stack
+    std::unique_ptr<Machine> m(new Machine);
+    m->engine = options.engine;
+    m->cyclesPerFrame = options.cyclesPerFrame;
+    m->seed = options.seed;
+    m->quirks = options.quirks;
+    m->reset();
+
+    int size = m->loadRom(path.c_str());
+    r.loaded = size >= 0;
+    r.displayHash = 0;
+    r.instructions = 0;
+    r.seconds = 0;
+    if (!r.loaded)
+        return;
+
+    Quirks q;
+    if (options.quirksDb && options.quirksDb->find(hashRom(m->ram + 0x200, size), q))
+        m->setQuirks(q);
+
+    auto begin = std::chrono::steady_clock::now();
+    m->runFrames(options.frames);
+    auto finish = std::chrono::steady_clock::now();
+
+    r.displayHash = hashDisplay(*m);
+    r.instructions = m->cycles;
+    r.seconds = std::chrono::duration<double>(finish - begin).count();
+}
+
+// Disassemble one ROM. Only its bytes are needed, not a whole machine.
+static void disassembleOne(const std::string &path, DisasmResult &r)
+{
+    u8 ram[4096] = {};
+    FILE *f = fopen(path.c_str(), "rb");
+    r.loaded = f != nullptr;
+    if (!f)
+        return;
+    size_t size = fread(ram + 0x200, 1, sizeof(ram) - 0x200, f);
+    fclose(f);
+
+    CodeMap map;
+    analyzeFlow(ram, 0x200 + size, map);
+    listProgram(ram, map, r.listing);
+}
+
+bool disassembleBatch(const std::string &dir, int jobs, std::vector<DisasmResult> &results)
+{
+    std::vector<std::string> names;
+    if (!listRoms(dir, names))
+        return false;
+
+    results.clear();
+    results.resize(names.size());
+
+    WorkPool pool(jobs);
+    for (size_t i = 0; i < names.size(); i++) {
+        results[i].name = names[i];
+        std::string path = dir + "/" + names[i];
+        DisasmResult *r = &results[i];
+        pool.submit([path, r] { disassembleOne(path, *r); });
+    }
+    pool.wait();
+
+    return true;
+}
+
+bool runBatch(const std::string &dir, const BatchOptions &options, std::vector<BatchResult> &results)
+{
+    std::vector<std::string> names;
+    if (!listRoms(dir, names))
+        return false;
+
+    results.clear();
+    results.resize(names.size());
+
+    WorkPool pool(options.jobs);
+    for (size_t i = 0; i < names.size(); i++) {
+        results[i].name = names[i];
+        std::string path = dir + "/" + names[i];
+        BatchResult *r = &results[i];
+        pool.submit([path, &options, r] { runOne(path, options, *r); });
+    }
+    pool.wait();
+
+    return true;
+}
@@ -0,0 +1,55 @@
+/*
+ *
+ * CHIPIT
+ *
+ * Batch mode: run every ROM in a directory headless, spread over all cores,
+ * and report a hash of the final display of each one. Or disassemble them
+ * all, the same way.
+ */
+
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "machine.h"
+
+struct BatchOptions {
+    u64 frames;
+    int cyclesPerFrame;
+    u32 seed;
+    Engine engine;
+    Quirks quirks;
+    const QuirksDatabase *quirksDb;  // if set, ROMs found in it get their own quirks
+    int jobs;            // worker threads, 0 for one per core
+};
+
+struct BatchResult {
+    std::string name;    // file name, without the directory
+    bool loaded;
+    u64 displayHash;     // FNV-1a of the final display
+    u64 instructions;
+    double seconds;      // wall time of this ROM alone
+};
+
+struct DisasmResult {
+    std::string name;    // file name, without the directory
+    bool loaded;
+    std::string listing; // see listProgram()
+};
+
+// Every regular file in dir, sorted by name. Returns false if dir can't be read.
+bool listRoms(const std::string &dir, std::vector<std::string> &names);
+
+// Run every ROM in dir. Results are in the same order as listRoms().
+bool runBatch(const std::string &dir, const BatchOptions &options, std::vector<BatchResult> &results);
+
+// Disassemble every ROM in dir with jobs worker threads (0 for one per core).
+// Results are in the same order as listRoms().
+bool disassembleBatch(const std::string &dir, int jobs, std::vector<DisasmResult> &results);
+
+u64 hashDisplay(const Machine &m);
+
+#endif
@@ -0,0 +1,102 @@
+/*
+ *
+ * CHIPIT
+ *
+ * Basic block cache.
+ */
+
+#include "machine.h"
+#include "block.h"
+
+// Does this instruction end a block? Anything that may not continue at the
+// next address, or that writes to RAM and so may change the code we're in.
+static bool endsBlock(u16 opcode)
+{
+    switch (opcode >> 12) {
+        case 0x0:
+            return opcode == 0x00EE || opcode == 0x00FD;
+        case 0x1: case 0x2: case 0x3: case 0x4:
+        case 0x5: case 0x9: case 0xB: case 0xE:
+            return true;
+        case 0xF:
+            switch (opcode & 0xFF) {
+                case 0x0A: case 0x33: case 0x55:
+                    return true;
+            }
+            return false;
+        default:
+            return false;
+    }
+}
+
+// Instructions that access the timers are never put in a block, because the
+// timers are only ticked after a whole block has been executed, even if a
+// frame ended halfway through it. A block ends right before them and they are
+// run one at a time.
+static bool touchesTimers(u16 opcode)
+{
+    if ((opcode >> 12) != 0xF)
+        return false;
+    switch (opcode & 0xFF) {
+        case 0x07: case 0x15: case 0x18:
+            return true;
+    }
+    return false;
+}
+
+BlockCache::BlockCache()
+{
+}
+
+Block *BlockCache::build(Machine &m, u16 addr)
+{
+    std::unique_ptr<Block> &slot = index[addr >> 1];
+    if (!slot)
+        slot.reset(new Block);
+
+    Block *b = slot.get();
+    b->start = addr;
+    b->length = 0;
+
+    while (b->length < blockMaxLength && addr < 0xFFF) {
+        u16 opcode = (m.ram[addr] << 8) | m.ram[addr + 1];
+        if (touchesTimers(opcode) || m.trapped(addr, opcode))
+            break;
+
+        b->ops[b->length++] = decode(opcode, m.quirks);
+        addr += 2;
+
+        if (endsBlock(opcode))
+            break;
+    }
+
+    b->end = addr;
+    b->valid = true;
+
+    for (u16 a = b->start; a < b->end; a++)
+        m.codeMap[a] = true;
+
+    return b;
+}
+
+void BlockCache::invalidate(u16 addr)
+{
+    // Only blocks starting at most blockMaxLength instructions back can cover addr
+    int first = addr - 2 * blockMaxLength;
+    if (first < 0)
+        first = 0;
+
+    for (int a = first & ~1; a <= addr; a += 2) {
+        Block *b = index[a >> 1].get();
+        if (b && b->valid && addr < b->end)
+            b->valid = false;
+    }
+}
+
+void BlockCache::clear()
+{
+    for (auto &b : index) {
+        if (b)
+            b->valid = false;
+    }
+}
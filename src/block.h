@@ -0,0 +1,64 @@
+/*
+ *
+ * CHIPIT
+ *
+ * Basic block cache.
+ *
+ * A block is a run of predecoded instructions starting at some address and
+ * ending with the first instruction that may change the flow of control
+ * (jumps, calls, returns, skips, Fx0A) or write to RAM (Fx33, Fx55), or right
+ * before one the debugger traps.
+ * Machine::runBlock() executes all instructions of a block back to back,
+ * without going through the main loop for every instruction.
+ */
+
+#ifndef BLOCK_H
+#define BLOCK_H
+
+#include <stdint.h>
+#include <memory>
+
+#include "decode.h"
+
+class Machine;
+
+// Longest block we build. Longer straight-line code is split in several blocks.
+const int blockMaxLength = 32;
+
+struct Block {
+    uint16_t start;      // address of the first instruction
+    uint16_t end;        // first address after the block
+    uint16_t length;     // number of instructions, 0 if nothing could be put in a block
+    bool valid;
+    Decoded ops[blockMaxLength];
+};
+
+class BlockCache {
+    public:
+        BlockCache();
+
+        // Get the block starting at addr (even, below 0x1000), building it if needed
+        Block *get(Machine &m, uint16_t addr)
+        {
+            Block *b = index[addr >> 1].get();
+            if (b && b->valid)
+                return b;
+            return build(m, addr);
+        }
+
+        // Drop every block that contains addr
+        void invalidate(uint16_t addr);
+
+        // Drop all blocks
+        void clear();
+
+    private:
+        Block *build(Machine &m, uint16_t addr);
+
+        // Blocks by start address / 2. Invalidated blocks are only marked as
+        // such and reused on the next build, since an invalidation can happen
+        // while the block is being executed.
+        std::unique_ptr<Block> index[4096 / 2];
+};
+
+#endif
@@ -0,0 +1,286 @@
+/*
+ *
+ * CHIPIT
+ *
+ * Breakpoints and watchpoints. See debugger.h.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <cstring>
+
+#include "debugger.h"
+
+// Does this instruction read / write RAM at I?
+static bool readsRam(u16 opcode)
+{
+    return (opcode & 0xF000) == 0xD000 || (opcode & 0xF0FF) == 0xF065;
+}
+
+static bool writesRam(u16 opcode)
+{
+    return (opcode & 0xF0FF) == 0xF033 || (opcode & 0xF0FF) == 0xF055;
+}
+
+Debugger::Debugger(Machine &m) : m(m), resuming(false)
+{
+    m.debugger = this;
+}
+
+Debugger::~Debugger()
+{
+    // The traps call back into us, get rid of them
+    m.debugger = nullptr;
+    m.stopped = false;
+    m.invalidateCode();
+}
+
+void Debugger::invalidate(u16 addr)
+{
+    addr &= 0xFFF;
+    m.decoded[addr >> 1].fn = opDecode;
+    if (m.codeMap[addr])
+        m.codeWritten(addr);
+}
+
+void Debugger::addBreakpoint(const Breakpoint &b)
+{
+    breakpoints.push_back(b);
+    breakMap[b.addr & 0xFFF] = true;
+    invalidate(b.addr);
+}
+
+void Debugger::removeBreakpoints(u16 addr)
+{
+    addr &= 0xFFF;
+    for (size_t i = 0; i < breakpoints.size(); ) {
+        if (breakpoints[i].addr == addr) {
+            breakpoints[i] = breakpoints.back();
+            breakpoints.pop_back();
+        } else {
+            i++;
+        }
+    }
+    breakMap[addr] = false;
+    invalidate(addr);
+}
+
+void Debugger::addWatchpoint(const Watchpoint &w)
+{
+    watchpoints.push_back(w);
+    for (int a = w.first; a <= w.last; a++) {
+        if (w.read)
+            readWatch[a & 0xFFF] = true;
+        if (w.write)
+            writeWatch[a & 0xFFF] = true;
+    }
+    // Any Dxyn, Fx33, Fx55 or Fx65 may hit it now
+    m.invalidateCode();
+}
+
+void Debugger::resume()
+{
+    if (!m.stopped)
+        return;
+    m.stopped = false;
+    resuming = true;
+}
+
+bool Debugger::traps(u16 addr, u16 opcode) const
+{
+    return breakMap[addr & 0xFFF]
+        || (readsRam(opcode) && readWatch.any())
+        || (writesRam(opcode) && writeWatch.any());
+}
+
+void Debugger::patch(u16 addr, u16 opcode, Decoded &d)
+{
+    if (!traps(addr, opcode))
+        return;
+    original[(addr & 0xFFF) >> 1] = d.fn;
+    d.fn = opTrap;
+}
+
+// Handler of every trapped instruction. PC is even and below 0x1000 here,
+// executeDecoded() makes sure of that.
+int Debugger::opTrap(Machine &m, const Decoded &d)
+{
+    Debugger &dbg = *m.debugger;
+
+    if (dbg.resuming) {
+        // The machine is going on from the instruction it stopped on
+        dbg.resuming = false;
+    } else if (!m.stopped) {
+        u16 opcode = m.ram[m.pc] << 8 | m.ram[m.pc + 1];
+        m.stopped = dbg.breakHit(m.pc) || dbg.watchHit(opcode);
+    }
+
+    if (m.stopped) {
+        // Stay on this instruction, and take back the instruction the engine
+        // is about to count for it
+        m.cycles--;
+        m.frameCycles--;
+        return 0;
+    }
+    return dbg.original[m.pc >> 1](m, d);
+}
+
+bool Debugger::breakHit(u16 addr)
+{
+    if (!breakMap[addr])
+        return false;
+
+    for (const Breakpoint &b : breakpoints) {
+        if (b.addr != addr)
+            continue;
+
+        u16 r = b.reg == 16 ? m.I : m.v[b.reg & 0xF];
+        bool hit = false;
+        switch (b.cond) {
+            case Cond::Always: hit = true; break;
+            case Cond::Eq: hit = r == b.value; break;
+            case Cond::Ne: hit = r != b.value; break;
+            case Cond::Lt: hit = r < b.value; break;
+            case Cond::Le: hit = r <= b.value; break;
+            case Cond::Gt: hit = r > b.value; break;
+            case Cond::Ge: hit = r >= b.value; break;
+        }
+        if (!hit)
+            continue;
+
+        char text[64];
+        if (b.cond == Cond::Always)
+            snprintf(text, sizeof(text), "breakpoint at 0x%03X", addr);
+        else if (b.reg == 16)
+            snprintf(text, sizeof(text), "breakpoint at 0x%03X, I = 0x%03X", addr, r);
+        else
+            snprintf(text, sizeof(text), "breakpoint at 0x%03X, V%X = 0x%02X", addr, b.reg, r);
+        why = text;
+        return true;
+    }
+    return false;
+}
+
+bool Debugger::watchHit(u16 opcode)
+{
+    int count;
+    bool write;
+    if ((opcode & 0xF000) == 0xD000) {
+        // A sprite for every selected plane, 16x16 ones for Dxy0
+        count = (opcode & 0xF ? opcode & 0xF : 32) * __builtin_popcount(m.display.planes);
+        write = false;
+    } else if ((opcode & 0xF0FF) == 0xF065) {
+        count = ((opcode >> 8) & 0xF) + 1;
+        write = false;
+    } else if ((opcode & 0xF0FF) == 0xF055) {
+        count = ((opcode >> 8) & 0xF) + 1;
+        write = true;
+    } else if ((opcode & 0xF0FF) == 0xF033) {
+        count = 3;
+        write = true;
+    } else {
+        return false;
+    }
+
+    const std::bitset<4096> &watch = write ? writeWatch : readWatch;
+    for (int i = 0; i < count; i++) {
+        u16 a = (m.I + i) & 0xFFF;
+        if (!watch[a])
+            continue;
+        char text[64];
+        snprintf(text, sizeof(text), "watchpoint: %04X at 0x%03X %s 0x%03X",
+                opcode, m.pc, write ? "writes" : "reads", a);
+        why = text;
+        return true;
+    }
+    return false;
+}
+
+bool Debugger::parseBreakpoint(const char *s, Breakpoint &b)
+{
+    char *end;
+    unsigned long addr = strtoul(s, &end, 0);
+    if (end == s || addr > 0xFFE || (addr & 1))
+        return false;
+
+    b.addr = addr;
+    b.cond = Cond::Always;
+    b.reg = 0;
+    b.value = 0;
+    if (*end == 0)
+        return true;
+    if (*end++ != ':')
+        return false;
+
+    // Register: V0 - VF or I
+    if (*end == 'v' || *end == 'V') {
+        end++;
+        char digit[2] = { *end, 0 };
+        char *e;
+        b.reg = strtol(digit, &e, 16);
+        if (e == digit)
+            return false;
+        end++;
+    } else if (*end == 'i' || *end == 'I') {
+        b.reg = 16;
+        end++;
+    } else {
+        return false;
+    }
+
+    static const struct { const char *text; Cond cond; } ops[] = {
+        { "==", Cond::Eq }, { "!=", Cond::Ne }, { "<=", Cond::Le },
+        { ">=", Cond::Ge }, { "<", Cond::Lt }, { ">", Cond::Gt },
+    };
+    bool found = false;
+    for (const auto &op : ops) {
+        size_t len = std::strlen(op.text);
+        if (std::strncmp(end, op.text, len) == 0) {
+            b.cond = op.cond;
+            end += len;
+            found = true;
+            break;
+        }
+    }
+    if (!found)
+        return false;
+
+    const char *v = end;
+    unsigned long value = strtoul(v, &end, 0);
+    if (end == v || *end != 0 || value > 0xFFFF)
+        return false;
+    b.value = value;
+    return true;
+}
+
+bool Debugger::parseWatchpoint(const char *s, Watchpoint &w)
+{
+    char *end;
+    unsigned long first = strtoul(s, &end, 0);
+    if (end == s || first > 0xFFF)
+        return false;
+
+    unsigned long last = first;
+    if (*end == '-') {
+        const char *l = end + 1;
+        last = strtoul(l, &end, 0);
+        if (end == l || last > 0xFFF || last < first)
+            return false;
+    }
+
+    w.first = first;
+    w.last = last;
+    w.read = w.write = true;
+    if (*end == 0)
+        return true;
+    if (*end++ != ':')
+        return false;
+
+    if (std::strcmp(end, "r") == 0)
+        w.write = false;
+    else if (std::strcmp(end, "w") == 0)
+        w.read = false;
+    else if (std::strcmp(end, "rw") != 0)
+        return false;
+    return true;
+}
@@ -0,0 +1,98 @@
+/*
+ *
+ * CHIPIT
+ *
+ * Breakpoints and watchpoints.
+ *
+ * Nothing in the engines checks for breakpoints while running. Instead, the
+ * instructions the debugger has to see (those at a breakpoint, and those that
+ * access RAM while a watchpoint is set: Dxyn, Fx33, Fx55 and Fx65) get their
+ * predecoded handler swapped for a trap when they're decoded. Blocks and
+ * translated code end right before such an instruction, so it's always run on
+ * its own through the predecoded cache. Everything else runs exactly as fast
+ * as without a debugger, and a machine without one pays nothing at all.
+ *
+ * When a trap hits, the machine stops on the instruction before it's run:
+ * Machine::stopped is set and the instruction keeps returning to itself
+ * without being counted (like Fx0A waiting for a key) until resume() is
+ * called. The rest of the current runCycles() is spent that way, so the
+ * frontend should check stopped after every frame.
+ */
+
+#ifndef DEBUGGER_H
+#define DEBUGGER_H
+
+#include <bitset>
+#include <string>
+#include <vector>
+
+#include "machine.h"
+
+class Debugger {
+    public:
+        // Breakpoint conditions compare a register with a value
+        enum class Cond { Always, Eq, Ne, Lt, Le, Gt, Ge };
+
+        struct Breakpoint {
+            u16 addr;
+            Cond cond;
+            int reg;             // 0 - 15 for V0 - VF, 16 for I
+            u16 value;
+        };
+
+        // Stops on reads and/or writes of first - last (inclusive)
+        struct Watchpoint {
+            u16 first, last;
+            bool read, write;
+        };
+
+        // Attach to m. Its cached code is thrown away as traps are set.
+        Debugger(Machine &m);
+        ~Debugger();
+
+        // Breakpoints only work on even addresses, like the predecoded cache
+        void addBreakpoint(const Breakpoint &b);
+        void removeBreakpoints(u16 addr);
+        bool hasBreakpoint(u16 addr) const { return breakMap[addr & 0xFFF]; }
+        void addWatchpoint(const Watchpoint &w);
+
+        // Parse a breakpoint (ADDR or ADDR:COND, e.g. 0x2a4:v3==0x10 or
+        // 0x300:i>=0x400) or a watchpoint (FIRST[-LAST][:r|w|rw], e.g.
+        // 0x3a0-0x3af:w) as given on the command line
+        static bool parseBreakpoint(const char *s, Breakpoint &b);
+        static bool parseWatchpoint(const char *s, Watchpoint &w);
+
+        // Let a stopped machine go on. The instruction it stopped on is run
+        // the next time without being checked.
+        void resume();
+
+        // Why the machine stopped last
+        const std::string &reason() const { return why; }
+
+        // For the engines: does the instruction at addr have to be trapped?
+        bool traps(u16 addr, u16 opcode) const;
+
+        // Swap the handler of the instruction at addr for a trap, if needed
+        void patch(u16 addr, u16 opcode, Decoded &d);
+
+    private:
+        static int opTrap(Machine &m, const Decoded &d);
+        bool breakHit(u16 addr);
+        bool watchHit(u16 opcode);
+
+        // Drop cached code for addr, or all of it
+        void invalidate(u16 addr);
+
+        Machine &m;
+        std::vector<Breakpoint> breakpoints;
+        std::vector<Watchpoint> watchpoints;
+        std::bitset<4096> breakMap;
+        std::bitset<4096> readWatch, writeWatch;
+        bool resuming;
+        std::string why;
+
+        // The handlers the traps replaced, by address / 2
+        OpHandler original[4096 / 2];
+};
+
+#endif
@@ -0,0 +1,467 @@
+/*
+ *
+ * CHIPIT
+ *
+ * Predecoded instructions. The handlers here must behave exactly like the
+ * corresponding cases in Machine::executeOpcode(), which is kept around as
+ * the reference implementation (--engine switch). The handlers of the
+ * instructions with quirks are instantiated for every quirk profile, and
+ * decode() picks the one for the machine's quirks.
+ */
+
+#include "machine.h"
+#include "decode.h"
+#include "debugger.h"
+
+// 0nnn - Call RCA 1802 program. Not implemented. Also used for unknown opcodes.
+static int opNop(Machine &m, const Decoded &d)
+{
+    return 2;
+}
+
+// 00E0 - Clear the screen
+static int op00E0(Machine &m, const Decoded &d)
+{
+    m.clearDisplay();
+    return 2;
+}
+
+// 00EE - Return from subroutine
+static int op00EE(Machine &m, const Decoded &d)
+{
+    m.stackptr = (m.stackptr - 1) & 0xF;
+    m.pc = m.stack[m.stackptr];
+    return 2;
+}
+
+// 00Cn - Scroll down n pixels
+static int op00Cn(Machine &m, const Decoded &d)
+{
+    m.scrollDown(d.n);
+    return 2;
+}
+
+// 00Dn - Scroll up n pixels
+static int op00Dn(Machine &m, const Decoded &d)
+{
+    m.scrollUp(d.n);
+    return 2;
+}
+
+// 00FB - Scroll right 4 pixels
+static int op00FB(Machine &m, const Decoded &d)
+{
+    m.scrollRight();
+    return 2;
+}
+
+// 00FC - Scroll left 4 pixels
+static int op00FC(Machine &m, const Decoded &d)
+{
+    m.scrollLeft();
+    return 2;
+}
+
+// 00FD - Exit. Stays on this instruction for good.
+static int op00FD(Machine &m, const Decoded &d)
+{
+    return 0;
+}
+
+// 00FE - Low resolution
+static int op00FE(Machine &m, const Decoded &d)
+{
+    m.setHires(false);
+    return 2;
+}
+
+// 00FF - High resolution
+static int op00FF(Machine &m, const Decoded &d)
+{
+    m.setHires(true);
+    return 2;
+}
+
+// 1nnn - Jump to address nnn
+static int op1nnn(Machine &m, const Decoded &d)
+{
+    m.pc = d.nnn;
+    return 0;
+}
+
+// 2nnn - Call subroutine at nnn
+static int op2nnn(Machine &m, const Decoded &d)
+{
+    m.stack[m.stackptr] = m.pc;
+    m.stackptr = (m.stackptr + 1) & 0xF;
+    m.pc = d.nnn;
+    return 0;
+}
+
+// 3xkk - Skip next instruction if Vx == kk
+static int op3xkk(Machine &m, const Decoded &d)
+{
+    return m.v[d.x] == d.kk ? 4 : 2;
+}
+
+// 4xkk - Skip next instruction if Vx != kk
+static int op4xkk(Machine &m, const Decoded &d)
+{
+    return m.v[d.x] != d.kk ? 4 : 2;
+}
+
+// 5xy0 - Skip next instruction if Vx == Vy
+static int op5xy0(Machine &m, const Decoded &d)
+{
+    return m.v[d.x] == m.v[d.y] ? 4 : 2;
+}
+
+// 6xkk - Vx = kk
+static int op6xkk(Machine &m, const Decoded &d)
+{
+    m.v[d.x] = d.kk;
+    return 2;
+}
+
+// 7xkk - Vx += kk
+static int op7xkk(Machine &m, const Decoded &d)
+{
+    m.v[d.x] += d.kk;
+    return 2;
+}
+
+// 8xy0 - Vx = Vy
+static int op8xy0(Machine &m, const Decoded &d)
+{
+    m.v[d.x] = m.v[d.y];
+    return 2;
+}
+
+// 8xy1 - Vx |= Vy
+static int op8xy1(Machine &m, const Decoded &d)
+{
+    m.v[d.x] |= m.v[d.y];
+    return 2;
+}
+
+// 8xy2 - Vx &= Vy
+static int op8xy2(Machine &m, const Decoded &d)
+{
+    m.v[d.x] &= m.v[d.y];
+    return 2;
+}
+
+// 8xy3 - Vx ^= Vy
+static int op8xy3(Machine &m, const Decoded &d)
+{
+    m.v[d.x] ^= m.v[d.y];
+    return 2;
+}
+
+// 8xy4 - Vx += Vy, VF = carry
+static int op8xy4(Machine &m, const Decoded &d)
+{
+    m.v[0xF] = (m.v[d.x] + m.v[d.y]) > 0xFF;
+    m.v[d.x] += m.v[d.y];
+    return 2;
+}
+
+// 8xy5 - Vx -= Vy, VF = not borrow
+static int op8xy5(Machine &m, const Decoded &d)
+{
+    m.v[0xF] = m.v[d.x] > m.v[d.y];
+    m.v[d.x] -= m.v[d.y];
+    return 2;
+}
+
+// 8xy6 - Vx >>= 1, VF = LSB of Vx before the shift. Vx = Vy >> 1 with the
+// shift quirk.
+template <class Q>
+static int op8xy6(Machine &m, const Decoded &d)
+{
+    m.v[0xF] = m.v[Q::shiftVy ? d.y : d.x] & 1;
+    m.v[d.x] = m.v[Q::shiftVy ? d.y : d.x] >> 1;
+    return 2;
+}
+
+// 8xy7 - Vx = Vy - Vx, VF = not borrow
+static int op8xy7(Machine &m, const Decoded &d)
+{
+    m.v[0xF] = !(m.v[d.x] > m.v[d.y]);
+    m.v[d.x] = m.v[d.y] - m.v[d.x];
+    return 2;
+}
+
+// 8xyE - Vx <<= 1, VF = MSB of Vx before the shift. Vx = Vy << 1 with the
+// shift quirk.
+template <class Q>
+static int op8xyE(Machine &m, const Decoded &d)
+{
+    m.v[0xF] = m.v[Q::shiftVy ? d.y : d.x] >> 7;
+    m.v[d.x] = m.v[Q::shiftVy ? d.y : d.x] << 1;
+    return 2;
+}
+
+// 9xy0 - Skip next instruction if Vx != Vy
+static int op9xy0(Machine &m, const Decoded &d)
+{
+    return m.v[d.x] != m.v[d.y] ? 4 : 2;
+}
+
+// Annn - I = nnn
+static int opAnnn(Machine &m, const Decoded &d)
+{
+    m.I = d.nnn;
+    return 2;
+}
+
+// Bnnn - Jump to nnn + V0, or to xnn + Vx with the jump quirk
+template <class Q>
+static int opBnnn(Machine &m, const Decoded &d)
+{
+    m.pc = m.v[Q::jumpVx ? d.x : 0x0] + d.nnn;
+    return 0;
+}
+
+// Cxkk - Vx = random number
+static int opCxkk(Machine &m, const Decoded &d)
+{
+    m.v[d.x] = m.nextRandom() % (d.kk + 1);
+    return 2;
+}
+
+// Dxyn - Draw sprite, 16x16 if n is 0
+template <class Q>
+static int opDxyn(Machine &m, const Decoded &d)
+{
+    m.drawSprite<Q>(d.x, d.y, d.n);
+    return 2;
+}
+
+// Ex9E - Skip next instruction if key Vx is pressed
+static int opEx9E(Machine &m, const Decoded &d)
+{
+    return m.key[m.v[d.x] & 0xF] ? 4 : 2;
+}
+
+// ExA1 - Skip next instruction if key Vx is not pressed
+static int opExA1(Machine &m, const Decoded &d)
+{
+    return m.key[m.v[d.x] & 0xF] ? 2 : 4;
+}
+
+// Fn01 - Select the planes n to draw to
+static int opFn01(Machine &m, const Decoded &d)
+{
+    m.display.planes = d.x & 3;
+    return 2;
+}
+
+// Fx07 - Vx = delay timer
+static int opFx07(Machine &m, const Decoded &d)
+{
+    m.v[d.x] = m.delaytimer;
+    return 2;
+}
+
+// Fx0A - Wait for keypress. Stays on this instruction until a key is down.
+static int opFx0A(Machine &m, const Decoded &d)
+{
+    for (int i = 0; i < 16; i++) {
+        if (m.key[i]) {
+            m.v[0x0] = i;
+            return 2;
+        }
+    }
+    return 0;
+}
+
+// Fx15 - delay timer = Vx
+static int opFx15(Machine &m, const Decoded &d)
+{
+    m.delaytimer = m.v[d.x];
+    return 2;
+}
+
+// Fx18 - sound timer = Vx
+static int opFx18(Machine &m, const Decoded &d)
+{
+    m.soundtimer = m.v[d.x];
+    return 2;
+}
+
+// Fx1E - I += Vx
+static int opFx1E(Machine &m, const Decoded &d)
+{
+    m.I += m.v[d.x];
+    return 2;
+}
+
+// Fx29 - I = location of font sprite for Vx
+static int opFx29(Machine &m, const Decoded &d)
+{
+    m.I = m.v[d.x] * 5;
+    return 2;
+}
+
+// Fx30 - I = location of big font sprite for Vx
+static int opFx30(Machine &m, const Decoded &d)
+{
+    m.I = bigFontAddr + (m.v[d.x] & 0xF) * 10;
+    return 2;
+}
+
+// Fx33 - Store BCD of Vx at I, I+1, I+2
+static int opFx33(Machine &m, const Decoded &d)
+{
+    u8 vx = m.v[d.x];
+    m.writeRam(m.I + 0, vx / 100);
+    m.writeRam(m.I + 1, (vx / 10) % 10);
+    m.writeRam(m.I + 2, vx % 10);
+    return 2;
+}
+
+// Fx55 - Store V0 - Vx at I, I += x + 1 unless the load/store quirk keeps I
+template <class Q>
+static int opFx55(Machine &m, const Decoded &d)
+{
+    for (int r = 0; r <= d.x; r++)
+        m.writeRam(m.I + r, m.v[r]);
+    if (!Q::keepI)
+        m.I += d.x + 1;
+    return 2;
+}
+
+// Fx65 - Load V0 - Vx from I, I += x + 1 unless the load/store quirk keeps I
+template <class Q>
+static int opFx65(Machine &m, const Decoded &d)
+{
+    for (int r = 0; r <= d.x; r++)
+        m.v[r] = m.ram[(m.I + r) & 0xFFF];
+    if (!Q::keepI)
+        m.I += d.x + 1;
+    return 2;
+}
+
+// Fx75 - Store V0 - Vx in the user flags
+static int opFx75(Machine &m, const Decoded &d)
+{
+    for (int r = 0; r <= d.x; r++)
+        m.flags[r] = m.v[r];
+    return 2;
+}
+
+// Fx85 - Load V0 - Vx from the user flags
+static int opFx85(Machine &m, const Decoded &d)
+{
+    for (int r = 0; r <= d.x; r++)
+        m.v[r] = m.flags[r];
+    return 2;
+}
+
+template <class Q>
+static Decoded decode(uint16_t opcode)
+{
+    Decoded d;
+    opcodeBits bits;
+    bits.opcode = opcode;
+
+    d.nnn = bits.t.b;
+    d.x = bits.n.b;
+    d.y = bits.n.c;
+    d.n = bits.n.d;
+    d.kk = bits.b.b;
+    d.fn = opNop;
+
+    switch (bits.n.a) {
+        case 0x0:
+            if (opcode == 0x00E0)
+                d.fn = op00E0;
+            else if (opcode == 0x00EE)
+                d.fn = op00EE;
+            else if ((opcode & 0xFFF0) == 0x00C0)
+                d.fn = op00Cn;
+            else if ((opcode & 0xFFF0) == 0x00D0)
+                d.fn = op00Dn;
+            else if (opcode == 0x00FB)
+                d.fn = op00FB;
+            else if (opcode == 0x00FC)
+                d.fn = op00FC;
+            else if (opcode == 0x00FD)
+                d.fn = op00FD;
+            else if (opcode == 0x00FE)
+                d.fn = op00FE;
+            else if (opcode == 0x00FF)
+                d.fn = op00FF;
+            break;
+        case 0x1: d.fn = op1nnn; break;
+        case 0x2: d.fn = op2nnn; break;
+        case 0x3: d.fn = op3xkk; break;
+        case 0x4: d.fn = op4xkk; break;
+        case 0x5: d.fn = op5xy0; break;
+        case 0x6: d.fn = op6xkk; break;
+        case 0x7: d.fn = op7xkk; break;
+        case 0x8:
+            switch (bits.n.d) {
+                case 0x0: d.fn = op8xy0; break;
+                case 0x1: d.fn = op8xy1; break;
+                case 0x2: d.fn = op8xy2; break;
+                case 0x3: d.fn = op8xy3; break;
+                case 0x4: d.fn = op8xy4; break;
+                case 0x5: d.fn = op8xy5; break;
+                case 0x6: d.fn = op8xy6<Q>; break;
+                case 0x7: d.fn = op8xy7; break;
+                case 0xE: d.fn = op8xyE<Q>; break;
+                default: break;
+            }
+            break;
+        case 0x9: d.fn = op9xy0; break;
+        case 0xA: d.fn = opAnnn; break;
+        case 0xB: d.fn = opBnnn<Q>; break;
+        case 0xC: d.fn = opCxkk; break;
+        case 0xD: d.fn = opDxyn<Q>; break;
+        case 0xE:
+            if (bits.b.b == 0x9E)
+                d.fn = opEx9E;
+            else if (bits.b.b == 0xA1)
+                d.fn = opExA1;
+            break;
+        case 0xF:
+            switch (bits.b.b) {
+                case 0x01: d.fn = opFn01; break;
+                case 0x07: d.fn = opFx07; break;
+                case 0x0A: d.fn = opFx0A; break;
+                case 0x15: d.fn = opFx15; break;
+                case 0x18: d.fn = opFx18; break;
+                case 0x1E: d.fn = opFx1E; break;
+                case 0x29: d.fn = opFx29; break;
+                case 0x30: d.fn = opFx30; break;
+                case 0x33: d.fn = opFx33; break;
+                case 0x55: d.fn = opFx55<Q>; break;
+                case 0x65: d.fn = opFx65<Q>; break;
+                case 0x75: d.fn = opFx75; break;
+                case 0x85: d.fn = opFx85; break;
+                default: break;
+            }
+            break;
+    }
+
+    return d;
+}
+
+Decoded decode(uint16_t opcode, Quirks quirks)
+{
+    Decoded d;
+    withQuirks(quirks, [&](auto policy) { d = decode<decltype(policy)>(opcode); });
+    return d;
+}
+
+int opDecode(Machine &m, const Decoded &d)
+{
+    Decoded &slot = m.decoded[m.pc >> 1];
+    u16 opcode = (m.ram[m.pc] << 8) | m.ram[m.pc + 1];
+    slot = decode(opcode, m.quirks);
+    if (m.debugger)
+        m.debugger->patch(m.pc, opcode, slot);
+    return slot.fn(m, slot);
+}
@@ -0,0 +1,52 @@
+/*
+ *
+ * CHIPIT
+ *
+ * Predecoded instructions.
+ *
+ * Instead of fetching and picking apart every opcode each time it is executed,
+ * each instruction is decoded once into a Decoded record: a pointer to the
+ * function implementing it plus its operands, already extracted.
+ * The records are cached per address in Machine::decoded and thrown away
+ * whenever the program writes to that address.
+ */
+
+#ifndef DECODE_H
+#define DECODE_H
+
+#include <stdint.h>
+
+#include "quirks.h"
+
+class Machine;
+struct Decoded;
+
+// An instruction handler. Returns how much PC should be advanced, just like
+// Machine::executeOpcode().
+typedef int (*OpHandler)(Machine &m, const Decoded &d);
+
+struct Decoded {
+    OpHandler fn;
+    uint16_t nnn;    // lowest 12 bits
+    uint8_t x;       // second nibble
+    uint8_t y;       // third nibble
+    uint8_t n;       // lowest nibble
+    uint8_t kk;      // lowest byte
+};
+
+// Is this one of the 00xx instructions that work on the screen? 00E0, and the
+// scrolls and resolution switches of the SUPER-CHIP and XO-CHIP.
+inline bool isScreenOp(uint16_t opcode)
+{
+    return opcode == 0x00E0 || (opcode & 0xFFE0) == 0x00C0
+        || opcode == 0x00FB || opcode == 0x00FC || opcode == 0x00FE || opcode == 0x00FF;
+}
+
+// Decode a single opcode, for a program with the given quirks
+Decoded decode(uint16_t opcode, Quirks quirks);
+
+// Placeholder handler for addresses that have not been decoded (yet).
+// Decodes the instruction at PC, stores it in the cache and executes it.
+int opDecode(Machine &m, const Decoded &d);
+
+#endif
@@ -0,0 +1,183 @@
+/*
+ *
+ * CHIPIT
+ *
+ * Disassembler. See disasm.h.
+ */
+
+#include <stdio.h>
+
+#include "disasm.h"
+
+char *formatInstruction(u16 addr, u16 opcode, char *out)
+{
+    opcodeBits bits;
+    bits.opcode = opcode;
+    unsigned x = bits.n.b, y = bits.n.c, n = bits.n.d;
+    unsigned kk = bits.b.b, nnn = bits.t.b;
+
+    int len = snprintf(out, disasmLineSize, "0x%04X: %04X - ", addr, opcode);
+    char *p = out + len;
+    size_t size = disasmLineSize - len;
+
+    switch (bits.n.a) {
+        case 0:
+            if (opcode == 0x00E0)
+                snprintf(p, size, "CLS");
+            else if (opcode == 0x00EE)
+                snprintf(p, size, "RTS");
+            else if ((opcode & 0xFFF0) == 0x00C0)
+                snprintf(p, size, "SCRD %X", n);
+            else if ((opcode & 0xFFF0) == 0x00D0)
+                snprintf(p, size, "SCRU %X", n);
+            else if (opcode == 0x00FB)
+                snprintf(p, size, "SCRR");
+            else if (opcode == 0x00FC)
+                snprintf(p, size, "SCRL");
+            else if (opcode == 0x00FD)
+                snprintf(p, size, "EXIT");
+            else if (opcode == 0x00FE)
+                snprintf(p, size, "LORES");
+            else if (opcode == 0x00FF)
+                snprintf(p, size, "HIRES");
+            else
+                snprintf(p, size, "CALL RCA1802 0x%04X", nnn);
+            break;
+        case 1:
+            snprintf(p, size, "JMP  0x%04X", nnn); break;
+        case 2:
+            snprintf(p, size, "CALL 0x%04X", nnn); break;
+        case 3:
+            snprintf(p, size, "SKIP if V%X == %02X", x, kk); break;
+        case 4:
+            snprintf(p, size, "SKIP if V%X != %02X", x, kk); break;
+        case 5:
+            snprintf(p, size, "SKIP if V%X == V%X", x, y); break;
+        case 6:
+            snprintf(p, size, "LOAD V%X, %02X", x, kk); break;
+        case 7:
+            snprintf(p, size, "ADD  V%X, %02X", x, kk); break;
+        case 8:
+            switch (n) {
+                case 0:
+                    snprintf(p, size, "LOAD V%X, V%X", x, y); break;
+                case 1:
+                    snprintf(p, size, "OR   V%X, V%X", x, y); break;
+                case 2:
+                    snprintf(p, size, "AND  V%X, V%X", x, y); break;
+                case 3:
+                    snprintf(p, size, "XOR  V%X, V%X", x, y); break;
+                case 4:
+                    snprintf(p, size, "ADD  V%X, V%X", x, y); break;
+                case 5:
+                    snprintf(p, size, "SUB  V%X, V%X", x, y); break;
+                case 6:
+                    snprintf(p, size, "RSH  V%X", x); break;
+                case 7:
+                    snprintf(p, size, "SUBX V%X, V%X", y, x); break;
+                case 0xE:
+                    snprintf(p, size, "LSH  V%X", x); break;
+                default:
+                    snprintf(p, size, "???"); break;
+            }
+            break;
+        case 9:
+            snprintf(p, size, "SKIP if V%X != V%X", x, y); break;
+        case 0xA:
+            snprintf(p, size, "LOAD I, %03X", nnn); break;
+        case 0xB:
+            snprintf(p, size, "JMP  %03X, V0", nnn); break;
+        case 0xC:
+            snprintf(p, size, "LOAD V%X, RND(%02X)", x, kk); break;
+        case 0xD:
+            snprintf(p, size, "DRAW V%X, V%X, %X", x, y, n); break;
+        case 0xE:
+            switch (kk) {
+                case 0x9E: snprintf(p, size, "KEYP V%X", x); break;
+                case 0xA1: snprintf(p, size, "KEYR V%X", x); break;
+                default:   snprintf(p, size, "???"); break;
+            }
+            break;
+        case 0xF:
+            switch (kk) {
+                case 0x01: snprintf(p, size, "PLANE %X", x); break;
+                case 0x07: snprintf(p, size, "LOAD V%X, dTIM", x); break;
+                case 0x0A: snprintf(p, size, "LOAD V%X, KEY", x); break;
+                case 0x15: snprintf(p, size, "LOAD dTIM, V%X", x); break;
+                case 0x18: snprintf(p, size, "LOAD sTIM, V%X", x); break;
+                case 0x1E: snprintf(p, size, "ADD  I, V%X", x); break;
+                case 0x29: snprintf(p, size, "LOAD I, SPR(V%X)", x); break;
+                case 0x30: snprintf(p, size, "LOAD I, BIG(V%X)", x); break;
+                case 0x33: snprintf(p, size, "LOAD I, BCD(V%X)", x); break;
+                case 0x55: snprintf(p, size, "DUMP V0 - V%X", x); break;
+                case 0x65: snprintf(p, size, "LOAD V0 - V%X", x); break;
+                case 0x75: snprintf(p, size, "DUMP V0 - V%X, FLAGS", x); break;
+                case 0x85: snprintf(p, size, "LOAD V0 - V%X, FLAGS", x); break;
+                default:   snprintf(p, size, "???"); break;
+            }
+            break;
+    }
+
+    return out;
+}
+
+void listProgram(const u8 *ram, const CodeMap &map, std::string &out)
+{
+    char line[disasmLineSize + 16];
+
+    int a = map.start;
+    while (a < map.end) {
+        if (map.callTargets[a]) {
+            snprintf(line, sizeof(line), "\nsub_0x%04X:\n", a);
+            out += line;
+        } else if (map.jumpTargets[a]) {
+            snprintf(line, sizeof(line), "loc_0x%04X:\n", a);
+            out += line;
+        }
+
+        if (map.code[a]) {
+            formatInstruction(a, ram[a] << 8 | ram[a + 1], line);
+            out += line;
+            out += '\n';
+            a += 2;
+            continue;
+        }
+
+        // Data up to the next instruction or label, 8 bytes per line. The
+        // second byte of an instruction that starts before it isn't data.
+        if (map.covered[a]) {
+            a++;
+            continue;
+        }
+        int len = snprintf(line, sizeof(line), "0x%04X: DATA", a);
+        int n = 0;
+        do {
+            len += snprintf(line + len, sizeof(line) - len, " %02X", ram[a]);
+            a++;
+            n++;
+        } while (n < 8 && a < map.end && !map.covered[a] && !map.jumpTargets[a] && !map.callTargets[a]);
+        out += line;
+        out += '\n';
+    }
+}
+
+const char *Disassembly::line(const MachineState &m, u16 addr)
+{
+    addr &= 0xFFF;
+    u16 opcode = m.ram[addr] << 8 | m.ram[(addr + 1) & 0xFFF];
+
+    Entry &e = (addr & 1) ? odd : entries[addr >> 1];
+    if (!e.valid || e.opcode != opcode || (addr & 1)) {
+        formatInstruction(addr, opcode, e.text);
+        e.opcode = opcode;
+        e.valid = true;
+    }
+    return e.text;
+}
+
+void Disassembly::clear()
+{
+    for (Entry &e : entries)
+        e.valid = false;
+    odd.valid = false;
+}
@@ -0,0 +1,59 @@
+/*
+ *
+ * CHIPIT
+ *
+ * Disassembler. Turns the instructions in a machine's RAM into one line of
+ * text each.
+ */
+
+#ifndef DISASM_H
+#define DISASM_H
+
+#include <stddef.h>
+#include <string>
+
+#include "machine.h"
+#include "flow.h"
+
+// Longest line formatInstruction() produces, with the terminating 0
+const size_t disasmLineSize = 40;
+
+// Format the instruction opcode at addr into out, which must hold
+// disasmLineSize bytes. Returns out.
+char *formatInstruction(u16 addr, u16 opcode, char *out);
+
+// Append a listing of the program in ram[map.start] - ram[map.end - 1] to
+// out: a label for every jump (loc_) and call (sub_) target, a line for every
+// instruction that can be reached, and whatever's left as data bytes.
+void listProgram(const u8 *ram, const CodeMap &map, std::string &out);
+
+/*
+ * Disassembly of a whole machine, one entry per even address (address / 2).
+ * Lines are only formatted when they're asked for, and kept until the opcode
+ * at their address changes, so asking again every frame costs no more than
+ * a compare and allocates nothing.
+ */
+class Disassembly {
+    public:
+        Disassembly() { clear(); }
+
+        // The line for the instruction at addr as it is in m's RAM now. The
+        // text stays valid until the next call for the same address (odd
+        // addresses, which aren't cached, share one line).
+        const char *line(const MachineState &m, u16 addr);
+
+        // Forget all formatted lines
+        void clear();
+
+    private:
+        struct Entry {
+            bool valid;
+            u16 opcode;
+            char text[disasmLineSize];
+        };
+
+        Entry entries[4096 / 2];
+        Entry odd;
+};
+
+#endif
@@ -0,0 +1,283 @@
+/*
+ *
+ * CHIPIT
+ *
+ * Drawing for the SFML frontend. See display.h.
+ */
+
+#include <stdio.h>
+#include <algorithm>
+#include <vector>
+
+#include "display.h"
+
+Disassembly disasm;
+
+/*
+ * The CHIP-8 screen. The display is converted to 128x64 RGBA pixels, uploaded to
+ * screenTexture in one go and drawn as a single sprite scaled up to c8Width x c8Height.
+ * The debug panel is drawn separately, see below.
+ */
+static const int fbWidth = Framebuffer::width;
+static const int fbHeight = Framebuffer::height;
+static sf::Texture screenTexture;
+static sf::Sprite screenSprite;
+static sf::Uint8 screenPixels[fbWidth * fbHeight * 4];
+
+// Rows to convert on the next update whether they're marked dirty or not
+static u64 forcedRows;
+
+// Convert and upload the given rows of the display. Each run of adjacent rows
+// is uploaded with a single texture update. Returns false if there are none.
+static bool updateScreen(const MachineState &m, u64 rows)
+{
+    rows |= forcedRows;
+    forcedRows = 0;
+    if (!rows)
+        return false;
+
+    int y = 0;
+    while (rows) {
+        while (!(rows & 1)) {
+            rows >>= 1;
+            y++;
+        }
+
+        int first = y;
+        for (; rows & 1; rows >>= 1, y++) {
+            Framebuffer::Row plane0 = m.display.row(0, y);
+            Framebuffer::Row plane1 = m.display.row(1, y);
+            sf::Uint8 *p = screenPixels + y * fbWidth * 4;
+            for (int x = 0; x < fbWidth; x++, plane0 <<= 1, plane1 <<= 1, p += 4) {
+                sf::Uint8 c = Framebuffer::shade((int)(plane0 >> (fbWidth - 1)) | (int)(plane1 >> (fbWidth - 1)) << 1);
+                p[0] = p[1] = p[2] = c;
+            }
+        }
+        screenTexture.update(screenPixels + first * fbWidth * 4, fbWidth, y - first, 0, first);
+    }
+    return true;
+}
+
+/*
+ * The debug panel. Text is drawn from a glyph atlas: every printable ASCII
+ * character of the font is rendered once, by initDisplay(), and the whole
+ * panel is a single vertex array with one quad per character cell, drawn in
+ * one go. A field is a fixed run of cells at some position; setting it only
+ * touches the cells whose character actually changes.
+ *
+ * What the panel currently shows is remembered in shown, and only fields
+ * whose value differs are formatted and set again.
+ */
+struct PanelState {
+    bool valid;          // false if every field has to be set again
+    u8 v[16];
+    u16 pc;
+    u16 I;
+    u8 stackptr;
+};
+static PanelState shown;
+
+static const int fontsize = 20;
+static const int fieldX = regX + (6 * fontsize) + 12;
+static const int disasmX = regX + (6 * fontsize) + 150;
+// Lines of disassembly above and below the one at PC
+static const int disasmAround = 5;
+
+static sf::Font sfmlFont;
+static const sf::Texture *atlas;
+
+struct GlyphCell {
+    sf::FloatRect bounds;    // relative to the baseline
+    sf::IntRect rect;        // in atlas
+};
+static GlyphCell glyphs[128];
+static float advance;        // width of every cell, the font is monospaced
+
+struct Field {
+    float x, y;              // top left
+    int length;
+    size_t first;            // first cell
+};
+static std::vector<Field> fields;
+static std::vector<char> cells;
+static sf::VertexArray panel(sf::Quads);
+
+// Fields, in the order they're created by initPanel()
+enum {
+    fieldV0 = 0,
+    fieldPC = fieldV0 + 16,
+    fieldI,
+    fieldSP,
+    fieldDisasm,             // 2 * disasmAround + 1 of them, from the top
+};
+
+static void loadGlyphs()
+{
+    for (int c = ' '; c <= '~'; c++) {
+        const sf::Glyph &g = sfmlFont.getGlyph(c, fontsize, false);
+        glyphs[c].bounds = g.bounds;
+        glyphs[c].rect = g.textureRect;
+    }
+    advance = sfmlFont.getGlyph('0', fontsize, false).advance;
+
+    // Only valid now that all glyphs have been rendered into it
+    atlas = &sfmlFont.getTexture(fontsize);
+}
+
+static void addField(float x, float y, int length, sf::Color color)
+{
+    fields.push_back(Field{ x, y, length, cells.size() });
+    cells.resize(cells.size() + length, ' ');
+    panel.resize(cells.size() * 4);
+    for (size_t v = fields.back().first * 4; v < cells.size() * 4; v++)
+        panel[v] = sf::Vertex(sf::Vector2f(x, y), color, sf::Vector2f(0, 0));
+}
+
+static void setCell(const Field &f, int i, char c)
+{
+    if (c < ' ' || c > '~')
+        c = '?';
+    cells[f.first + i] = c;
+
+    const GlyphCell &g = glyphs[(int)c];
+    float left = f.x + i * advance + g.bounds.left;
+    float top = f.y + fontsize + g.bounds.top;
+    float right = left + g.bounds.width;
+    float bottom = top + g.bounds.height;
+    float u0 = g.rect.left, v0 = g.rect.top;
+    float u1 = u0 + g.rect.width, v1 = v0 + g.rect.height;
+
+    sf::Vertex *q = &panel[(f.first + i) * 4];
+    q[0].position = sf::Vector2f(left, top);
+    q[1].position = sf::Vector2f(right, top);
+    q[2].position = sf::Vector2f(right, bottom);
+    q[3].position = sf::Vector2f(left, bottom);
+    q[0].texCoords = sf::Vector2f(u0, v0);
+    q[1].texCoords = sf::Vector2f(u1, v0);
+    q[2].texCoords = sf::Vector2f(u1, v1);
+    q[3].texCoords = sf::Vector2f(u0, v1);
+}
+
+// Show s in a field, padded with spaces. Returns false if nothing changed.
+static bool setField(int field, const char *s)
+{
+    const Field &f = fields[field];
+    bool changed = false;
+    for (int i = 0; i < f.length; i++) {
+        char c = *s ? *s++ : ' ';
+        if (cells[f.first + i] != c) {
+            setCell(f, i, c);
+            changed = true;
+        }
+    }
+    return changed;
+}
+
+static void initPanel()
+{
+    fields.clear();
+    cells.clear();
+
+    for (int reg = 0; reg < 16; reg++)
+        addField(regX, regY + (reg * (fontsize + 4)), 6, sf::Color::White);
+    addField(fieldX, regY, 8, sf::Color::White);
+    addField(fieldX, regY + (fontsize + 2), 8, sf::Color::White);
+    addField(fieldX, regY + 2 * (fontsize + 2), 8, sf::Color::White);
+
+    // The instruction at PC is highlighted
+    int centerY = regY + 80;
+    for (int line = -disasmAround; line <= disasmAround; line++)
+        addField(disasmX, centerY + line * 16, disasmLineSize - 1, line ? sf::Color::White : sf::Color::Cyan);
+}
+
+// Set the panel fields whose value changed. Returns false if nothing changed.
+static bool updatePanel(const MachineState &m)
+{
+    char out[16];
+    bool changed = false;
+
+    // - Registers
+    for (int reg = 0; reg < 16; reg++) {
+        if (shown.valid && shown.v[reg] == m.v[reg])
+            continue;
+        snprintf(out, sizeof(out), "V%01X: %02X", reg, m.v[reg]);
+        changed |= setField(fieldV0 + reg, out);
+        shown.v[reg] = m.v[reg];
+    }
+
+    // PC. The disassembly is centered on it, so it moves along.
+    if (!shown.valid || shown.pc != m.pc) {
+        snprintf(out, sizeof(out), "PC: %04X", m.pc);
+        changed |= setField(fieldPC, out);
+
+        for (int line = -disasmAround; line <= disasmAround; line++) {
+            int addr = m.pc + line * 2;
+            const char *text = addr >= 0 && addr <= 0xFFE ? disasm.line(m, addr) : "";
+            changed |= setField(fieldDisasm + disasmAround + line, text);
+        }
+
+        shown.pc = m.pc;
+    }
+
+    // I
+    if (!shown.valid || shown.I != m.I) {
+        snprintf(out, sizeof(out), " I: %04X", m.I);
+        changed |= setField(fieldI, out);
+        shown.I = m.I;
+    }
+
+    // SP
+    if (!shown.valid || shown.stackptr != m.stackptr) {
+        snprintf(out, sizeof(out), "SP: %04X", m.stackptr);
+        changed |= setField(fieldSP, out);
+        shown.stackptr = m.stackptr;
+    }
+
+    // TODO: timers
+    // TODO: keys
+    // TODO: RAM
+
+    shown.valid = true;
+    return changed;
+}
+
+bool updateDisplay(const MachineState &m, u64 dirtyRows)
+{
+    bool panel = updatePanel(m);
+    bool screen = updateScreen(m, dirtyRows);
+    return panel || screen;
+}
+
+void drawDisplay(sf::RenderTarget &target)
+{
+    target.draw(panel, sf::RenderStates(atlas));
+    target.draw(screenSprite);
+}
+
+bool initDisplay()
+{
+    if (!screenTexture.create(fbWidth, fbHeight))
+        return false;
+    screenTexture.setSmooth(false);
+    for (int i = 0; i < fbWidth * fbHeight; i++)
+        screenPixels[i * 4 + 3] = 0xFF;
+    screenSprite.setTexture(screenTexture);
+    screenSprite.setScale(pixelWidth, pixelHeight);
+    screenSprite.setPosition(c8X, c8Y);
+
+    if (!sfmlFont.loadFromFile("Courier Prime Code.ttf"))
+        return false;
+
+    loadGlyphs();
+    initPanel();
+    invalidateDisplay();
+    return true;
+}
+
+void invalidateDisplay()
+{
+    shown.valid = false;
+    // No cell holds a 0, so every one is set again
+    std::fill(cells.begin(), cells.end(), 0);
+    forcedRows = ~0ull;
+}
@@ -0,0 +1,49 @@
+/*
+ *
+ * CHIPIT
+ *
+ * Drawing for the SFML frontend: the CHIP-8 screen and the debug panel. They
+ * can be drawn to any render target, the window (owned by main.cpp) or an
+ * off screen one (see bench/).
+ */
+
+#ifndef DISPLAY_H
+#define DISPLAY_H
+
+#include <SFML/Graphics.hpp>
+
+#include "machine.h"
+#include "disasm.h"
+
+// Size of a pixel of the 128x64 framebuffer, a low resolution pixel is 2x2 of them
+const int pixelWidth = 8;
+const int pixelHeight = 8;
+const int c8Width = Framebuffer::width * pixelWidth;
+const int c8Height = Framebuffer::height * pixelHeight;
+const int screenWidth = c8Width + 500;
+const int screenHeight = c8Height + 500;
+// CHIP-8 output offset
+const int c8X = (screenWidth / 2) - (c8Width / 2) + 20, c8Y = 20;
+// Registers output offset
+const int regX = 32;
+const int regY = c8Height + 32;
+
+// Disassembly shown next to the registers
+extern Disassembly disasm;
+
+// Create the screen texture, load the font and render its glyphs. Returns
+// false if that fails.
+bool initDisplay();
+
+// Forget what's on screen, the next updateDisplay() draws everything again
+void invalidateDisplay();
+
+// Bring the panel and the CHIP-8 screen up to date with m. dirtyRows are the
+// display rows changed since the last update (see Machine::dirtyRows).
+// Returns true if anything changed and the target has to be drawn again.
+bool updateDisplay(const MachineState &m, u64 dirtyRows);
+
+// Draw the panel and the screen, screenWidth x screenHeight
+void drawDisplay(sf::RenderTarget &target);
+
+#endif
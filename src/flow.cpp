@@ -0,0 +1,80 @@
+/*
+ *
+ * CHIPIT
+ *
+ * Control flow analysis. See flow.h.
+ */
+
+#include <vector>
+
+#include "flow.h"
+
+void analyzeFlow(const u8 *ram, u16 end, CodeMap &map)
+{
+    if (end > 0x1000)
+        end = 0x1000;
+
+    map.start = 0x200;
+    map.end = end;
+    map.code.reset();
+    map.covered.reset();
+    map.jumpTargets.reset();
+    map.callTargets.reset();
+    map.leaders.reset();
+    map.computed.reset();
+
+    std::vector<u16> todo;
+    auto follow = [&](u16 addr) {
+        map.leaders[addr & 0xFFF] = true;
+        todo.push_back(addr);
+    };
+    follow(map.start);
+
+    while (!todo.empty()) {
+        u16 a = todo.back();
+        todo.pop_back();
+
+        // Go down this path until it ends or runs into code we've seen
+        while (a >= map.start && a + 1 < end && !map.code[a]) {
+            u16 opcode = ram[a] << 8 | ram[a + 1];
+            u16 nnn = opcode & 0xFFF;
+            map.code[a] = true;
+            map.covered[a] = map.covered[a + 1] = true;
+
+            if (opcode == 0x00EE || opcode == 0x00FD)
+                break;
+
+            bool next = true;
+            switch (opcode >> 12) {
+                case 0x1:
+                    map.jumpTargets[nnn] = true;
+                    follow(nnn);
+                    next = false;
+                    break;
+                case 0x2:
+                    map.callTargets[nnn] = true;
+                    follow(nnn);
+                    // Returns come back to the next instruction
+                    map.leaders[(a + 2) & 0xFFF] = true;
+                    break;
+                case 0x3: case 0x4: case 0x5: case 0x9: case 0xE:
+                    follow(a + 4);
+                    map.leaders[(a + 2) & 0xFFF] = true;
+                    break;
+                case 0xB:
+                    map.computed[a] = true;
+                    next = false;
+                    break;
+            }
+            if (!next)
+                break;
+            a += 2;
+        }
+    }
+
+    // Addresses outside the program may have been marked on the way
+    for (int a = 0; a < map.start; a++)
+        map.leaders[a] = false;
+    for (int a = end; a < 0x1000; a++)
+        map.leaders[a] = false;
+}
@@ -0,0 +1,44 @@
+/*
+ *
+ * CHIPIT
+ *
+ * Control flow analysis of a program image.
+ *
+ * Starting at 0x200, every instruction that can be reached is followed
+ * (recursive descent): jumps go to their target, calls to their target and
+ * the next instruction, skips to both the next instruction and the one after
+ * it, and returns end a path. Whatever is never reached is taken as data, so
+ * sprites aren't decoded as instructions and code at odd addresses is found
+ * where it's actually jumped to.
+ *
+ * The analysis can't see where Bnnn (jump to nnn + V0) goes or what the
+ * program writes into its own code, so those paths end there. They're marked
+ * so the users of the map can deal with them.
+ */
+
+#ifndef FLOW_H
+#define FLOW_H
+
+#include <bitset>
+
+#include "machine.h"
+
+struct CodeMap {
+    u16 start;                       // entry point, 0x200
+    u16 end;                         // first address after the program
+
+    std::bitset<4096> code;          // first byte of every reachable instruction
+    std::bitset<4096> covered;       // every byte of a reachable instruction
+    std::bitset<4096> jumpTargets;   // targets of 1nnn
+    std::bitset<4096> callTargets;   // targets of 2nnn
+    std::bitset<4096> leaders;       // first instruction of every basic block
+    std::bitset<4096> computed;      // Bnnn instructions, whose target isn't known
+
+    bool isCode(u16 addr) const { return code[addr & 0xFFF]; }
+};
+
+// Analyse the program in ram[0x200] - ram[end - 1]. Only addresses in that
+// range are followed.
+void analyzeFlow(const u8 *ram, u16 end, CodeMap &map);
+
+#endif
@@ -0,0 +1,259 @@
+/*
+ *
+ * CHIPIT
+ *
+ * The screen, with the SUPER-CHIP and XO-CHIP extensions: 128x64 pixels in
+ * two bitplanes.
+ *
+ * A CHIP-8 program sees 64x32 pixels (low resolution), each of which is a
+ * 2x2 block here. After 00FF (high resolution) the program addresses all
+ * 128x64 of them. Either way the frontend shows the same 128x64 grid. Fn01
+ * selects the planes that are drawn to, cleared and scrolled; the colour of
+ * a pixel is made up of its bits in both planes.
+ *
+ * Each row of a plane is packed in two 64-bit words, its left and its right
+ * half, with the leftmost pixel in the most significant bit. The halves are
+ * kept in arrays of their own, so the same half of consecutive rows is
+ * adjacent in memory: scrolling sideways is the same shift applied to 64
+ * words in a row, which the compiler turns into vector shifts, and scrolling
+ * up or down is a memmove of each array. A sprite row is shifted into place
+ * once, into the two words it covers, so it's checked for collisions and
+ * drawn with one AND and one XOR per half.
+ *
+ * In low resolution the rows come in identical pairs: everything that changes
+ * the screen there does so two rows at a time, and switching resolution
+ * clears it. So a sprite is only drawn onto the first row of each pair, which
+ * is then copied to the second.
+ *
+ * Framebuffer is part of MachineState, so it's a plain struct too.
+ */
+
+#ifndef FRAMEBUFFER_H
+#define FRAMEBUFFER_H
+
+#include <stdint.h>
+#include <cstring>
+
+struct Framebuffer {
+    static const int width = 128;
+    static const int height = 64;
+    static const int planeCount = 2;
+
+    // A whole row of a plane
+    typedef unsigned __int128 Row;
+
+    uint64_t left[planeCount][height];
+    uint64_t right[planeCount][height];
+
+    // Set by 00FF, cleared by 00FE: the program addresses 128x64 pixels
+    // rather than 64x32
+    uint8_t hires;
+
+    // Set by Fn01: the planes that are drawn to, cleared and scrolled, bit p
+    // for plane p. Only plane 0 after a reset.
+    uint8_t planes;
+
+    Row row(int p, int y) const { return (Row)left[p][y] << 64 | right[p][y]; }
+
+    // Pixels here per pixel of the program, in either direction
+    unsigned scale() const { return hires ? 1 : 2; }
+
+    // Colour of the pixel at (x, y): bit p is its bit in plane p
+    int pixel(int x, int y) const
+    {
+        int c = 0;
+        for (int p = 0; p < planeCount; p++)
+            c |= (int)(row(p, y) >> (width - 1 - x) & 1) << p;
+        return c;
+    }
+
+    // Grey level of a colour, for the frontend and video recording. A program
+    // that only uses the first plane is black and white.
+    static uint8_t shade(int colour)
+    {
+        static const uint8_t shades[1 << planeCount] = { 0x00, 0xFF, 0xAA, 0x55 };
+        return shades[colour];
+    }
+
+    // The operations return the rows that (may) have changed, bit y for row y,
+    // to be added to Machine::dirtyRows.
+
+    // 00E0 - Clear the selected planes
+    uint64_t clear()
+    {
+        uint64_t dirty = 0;
+        for (int p = 0; p < planeCount; p++) {
+            if (!(planes >> p & 1))
+                continue;
+            for (int y = 0; y < height; y++)
+                dirty |= (uint64_t)((left[p][y] | right[p][y]) != 0) << y;
+            std::memset(left[p], 0, sizeof(left[p]));
+            std::memset(right[p], 0, sizeof(right[p]));
+        }
+        return dirty;
+    }
+
+    // 00FE/00FF - Switch resolution. The whole screen is cleared, in every
+    // plane, as XO-CHIP does.
+    uint64_t setHires(bool on)
+    {
+        hires = on;
+        uint8_t selected = planes;
+        planes = (1 << planeCount) - 1;
+        uint64_t dirty = clear();
+        planes = selected;
+        return dirty;
+    }
+
+    // 00Cn/00Dn - Scroll the selected planes down/up by n pixels of the program
+    uint64_t scrollDown(unsigned n) { return scrollRows(n * scale(), true); }
+    uint64_t scrollUp(unsigned n) { return scrollRows(n * scale(), false); }
+
+    // 00FB/00FC - Scroll the selected planes right/left by 4 pixels of the
+    // program. Both loops are vectorised.
+    uint64_t scrollRight()
+    {
+        unsigned s = 4 * scale();
+        for (int p = 0; p < planeCount; p++) {
+            if (!(planes >> p & 1))
+                continue;
+            for (int y = 0; y < height; y++) {
+                right[p][y] = right[p][y] >> s | left[p][y] << (64 - s);
+                left[p][y] >>= s;
+            }
+        }
+        return planes ? ~0ull : 0;
+    }
+
+    uint64_t scrollLeft()
+    {
+        unsigned s = 4 * scale();
+        for (int p = 0; p < planeCount; p++) {
+            if (!(planes >> p & 1))
+                continue;
+            for (int y = 0; y < height; y++) {
+                left[p][y] = left[p][y] << s | right[p][y] >> (64 - s);
+                right[p][y] <<= s;
+            }
+        }
+        return planes ? ~0ull : 0;
+    }
+
+    // Dxyn - XOR a sprite onto the selected planes at (x, y), in pixels of the
+    // program, and tell whether any pixel was erased. The sprite is 8 pixels
+    // wide and h rows high, or 16x16 if h is 0 (two bytes per row). byte(i)
+    // gets byte i of the sprite data, which has a sprite for every selected
+    // plane, one after the other.
+    //
+    // The sprite starts at (x, y) wrapped into the screen. Whatever sticks out
+    // on the right or the bottom wraps around as well, or isn't drawn with the
+    // clip quirk. In low resolution each bit of the sprite is doubled before
+    // the row is shifted into place.
+    template <class Q, class Fetch>
+    uint64_t draw(unsigned x, unsigned y, unsigned h, Fetch byte, bool &collision)
+    {
+        return hires ? drawAt<Q, 1>(x, y, h, byte, collision) : drawAt<Q, 2>(x, y, h, byte, collision);
+    }
+
+    // Helpers of the above
+    template <class Q, unsigned S, class Fetch>
+    uint64_t drawAt(unsigned x, unsigned y, unsigned h, Fetch byte, bool &collision)
+    {
+        const unsigned w = width / S;
+        const unsigned hgt = height / S;
+        x &= w - 1;
+        y &= hgt - 1;
+
+        unsigned cols = h ? 8 : 16;
+        unsigned rows = h ? h : 16;
+        unsigned visible = Q::clip && y + rows > hgt ? hgt - y : rows;
+
+        // The sprite row starts in the left half of the screen row, or in the
+        // right one, at bit b of it. Whatever doesn't fit goes to the other
+        // half, wrapping around from the right one to the left one.
+        unsigned shift = x * S;
+        bool inRight = shift >= 64;
+        unsigned b = shift & 63;
+
+        uint64_t hit = 0;
+        uint64_t dirty = 0;
+        unsigned data = 0;      // the current plane's sprite
+        for (int p = 0; p < planeCount; p++) {
+            if (!(planes >> p & 1))
+                continue;
+            for (unsigned r = 0; r < visible; r++) {
+                uint32_t bits;
+                if (h)
+                    bits = S == 2 ? doubled().bits[byte(data + r)] : byte(data + r);
+                else if (S == 2)
+                    bits = doubled().bits[byte(data + 2 * r)] << 16 | doubled().bits[byte(data + 2 * r + 1)];
+                else
+                    bits = byte(data + 2 * r) << 8 | byte(data + 2 * r + 1);
+                uint64_t sprite = (uint64_t)bits << (64 - cols * S);
+                uint64_t first = sprite >> b;
+                uint64_t rest = sprite << 1 << (63 - b);
+                uint64_t hi = inRight ? (Q::clip ? 0 : rest) : first;
+                uint64_t lo = inRight ? first : rest;
+                if (!(hi | lo))
+                    continue;
+
+                unsigned top = ((y + r) & (hgt - 1)) * S;
+                hit |= (left[p][top] & hi) | (right[p][top] & lo);
+                left[p][top] ^= hi;
+                right[p][top] ^= lo;
+                if (S == 2) {
+                    left[p][top + 1] = left[p][top];
+                    right[p][top + 1] = right[p][top];
+                }
+                dirty |= (S == 2 ? 3ull : 1ull) << top;
+            }
+            data += rows * cols / 8;
+        }
+
+        collision = hit != 0;
+        return dirty;
+    }
+
+    uint64_t scrollRows(unsigned n, bool down)
+    {
+        if (n > (unsigned)height)
+            n = height;
+        if (!n || !planes)
+            return 0;
+        size_t kept = (height - n) * sizeof(uint64_t);
+        size_t cleared = n * sizeof(uint64_t);
+        for (int p = 0; p < planeCount; p++) {
+            if (!(planes >> p & 1))
+                continue;
+            for (uint64_t *half : { left[p], right[p] }) {
+                if (down) {
+                    std::memmove(half + n, half, kept);
+                    std::memset(half, 0, cleared);
+                } else {
+                    std::memmove(half, half + n, kept);
+                    std::memset(half + height - n, 0, cleared);
+                }
+            }
+        }
+        return ~0ull;
+    }
+
+    // Every bit of a byte twice, for low resolution
+    struct Doubled {
+        uint16_t bits[256];
+        constexpr Doubled() : bits()
+        {
+            for (int i = 0; i < 256; i++) {
+                for (int b = 0; b < 8; b++)
+                    bits[i] |= (i >> b & 1) * (3 << 2 * b);
+            }
+        }
+    };
+    static const Doubled &doubled()
+    {
+        static constexpr Doubled table;
+        return table;
+    }
+};
+
+#endif
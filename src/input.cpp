@@ -0,0 +1,139 @@
+/*
+ *
+ * CHIPIT
+ *
+ * Input recording and replay. See input.h.
+ */
+
+#include <stdio.h>
+#include <cstring>
+
+#include "input.h"
+
+struct InputHeader {
+    char magic[8];
+    u32 seed;
+    u32 cyclesPerFrame;
+    u64 frames;
+    u64 startHash;
+    u64 finalHash;
+    u64 eventBytes;
+};
+static const char inputMagic[8] = { 'C', 'H', 'I', 'P', 'I', 'T', 'I', 'N' };
+
+InputLog::InputLog()
+{
+    seed = 0;
+    cyclesPerFrame = 0;
+    frames = 0;
+    startHash = 0;
+    finalHash = 0;
+
+    lastFrame = 0;
+    std::memset(lastKeys, 0, sizeof(lastKeys));
+
+    pos = 0;
+    pending = false;
+    pendingFrame = 0;
+}
+
+void InputLog::record(u64 frame, const u8 keys[16])
+{
+    for (int k = 0; k < 16; k++) {
+        if (!keys[k] == !lastKeys[k])
+            continue;
+
+        for (u64 delta = frame - lastFrame; ; delta >>= 7) {
+            if (delta < 0x80) {
+                events.push_back(delta);
+                break;
+            }
+            events.push_back((delta & 0x7F) | 0x80);
+        }
+        events.push_back((keys[k] ? 0x10 : 0x00) | k);
+
+        lastFrame = frame;
+        lastKeys[k] = keys[k];
+    }
+}
+
+// Decode the frame of the next event, if there is one
+void InputLog::nextEvent()
+{
+    pending = false;
+    u64 delta = 0;
+    for (int shift = 0; pos < events.size(); shift += 7) {
+        u8 b = events[pos++];
+        delta |= (u64)(b & 0x7F) << shift;
+        if (!(b & 0x80)) {
+            pending = pos < events.size();
+            pendingFrame += delta;
+            return;
+        }
+    }
+}
+
+void InputLog::replay(u64 frame, u8 keys[16])
+{
+    if (frame == 0) {
+        pos = 0;
+        pendingFrame = 0;
+        nextEvent();
+    }
+
+    while (pending && pendingFrame == frame) {
+        u8 e = events[pos++];
+        keys[e & 0xF] = e >> 4;
+        nextEvent();
+    }
+}
+
+bool InputLog::save(const char *filename) const
+{
+    FILE *f = fopen(filename, "wb");
+    if (!f)
+        return false;
+
+    InputHeader h;
+    std::memset(&h, 0, sizeof(h));
+    std::memcpy(h.magic, inputMagic, sizeof(h.magic));
+    h.seed = seed;
+    h.cyclesPerFrame = cyclesPerFrame;
+    h.frames = frames;
+    h.startHash = startHash;
+    h.finalHash = finalHash;
+    h.eventBytes = events.size();
+
+    bool ok = fwrite(&h, sizeof(h), 1, f) == 1
+        && (events.empty() || fwrite(events.data(), events.size(), 1, f) == 1);
+    return fclose(f) == 0 && ok;
+}
+
+bool InputLog::load(const char *filename)
+{
+    FILE *f = fopen(filename, "rb");
+    if (!f)
+        return false;
+
+    InputHeader h;
+    bool ok = fread(&h, sizeof(h), 1, f) == 1
+        && std::memcmp(h.magic, inputMagic, sizeof(h.magic)) == 0
+        && h.cyclesPerFrame > 0;
+    if (ok) {
+        events.resize(h.eventBytes);
+        ok = events.empty() || fread(events.data(), events.size(), 1, f) == 1;
+    }
+    fclose(f);
+    if (!ok)
+        return false;
+
+    seed = h.seed;
+    cyclesPerFrame = h.cyclesPerFrame;
+    frames = h.frames;
+    startHash = h.startHash;
+    finalHash = h.finalHash;
+    pos = 0;
+    pending = false;
+    pendingFrame = 0;
+    return true;
+}
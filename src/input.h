@@ -0,0 +1,60 @@
+/*
+ *
+ * CHIPIT
+ *
+ * Input recording and replay.
+ *
+ * A run is fully determined by the program, the seed of the machine's random
+ * number generator, the number of instructions per frame and the keys that
+ * were down in every frame. An input log keeps the key changes, keyed by the
+ * frame they were first seen in, together with hashes of the machine state at
+ * the start and at the end, so a replay can check it ends up in the same state.
+ *
+ * On disk: a header, then one event per key change: the number of frames
+ * since the previous event as a little endian base 128 varint, and a byte
+ * holding the key in the low nibble and 1 (down) or 0 (up) in the high one.
+ */
+
+#ifndef INPUT_H
+#define INPUT_H
+
+#include <vector>
+
+#include "machine.h"
+
+class InputLog {
+    public:
+        InputLog();
+
+        // Recording: call with the keys at the start of every frame
+        void record(u64 frame, const u8 keys[16]);
+
+        // Replay: call at the start of every frame, from frame 0 on, to update
+        // keys with the changes of that frame
+        void replay(u64 frame, u8 keys[16]);
+
+        bool save(const char *filename) const;
+        bool load(const char *filename);
+
+        u32 seed;
+        int cyclesPerFrame;
+        u64 frames;          // length of the run
+        u64 startHash;       // Machine::stateHash() before the first frame
+        u64 finalHash;       // and after the last one
+
+    private:
+        void nextEvent();
+
+        std::vector<u8> events;
+
+        // Recording
+        u64 lastFrame;
+        u8 lastKeys[16];
+
+        // Replay
+        size_t pos;
+        bool pending;        // is there an event at pendingFrame?
+        u64 pendingFrame;
+};
+
+#endif
@@ -0,0 +1,429 @@
+/*
+ *
+ * CHIPIT
+ *
+ * x86-64 dynamic recompiler. See jit.h.
+ */
+
+#include <cstring>
+
+#if defined(__x86_64__) && defined(__unix__)
+#include <sys/mman.h>
+#define JIT_SUPPORTED 1
+#endif
+
+#include "machine.h"
+#include "jit.h"
+
+// Can this instruction be translated? Nothing that works on the screen is.
+static bool translatable(u16 opcode)
+{
+    switch (opcode >> 12) {
+        case 0x0:
+            return !isScreenOp(opcode) && opcode != 0x00FD;
+        case 0xC:
+        case 0xD:
+            return false;
+        case 0xF:
+            switch (opcode & 0xFF) {
+                case 0x01: case 0x07: case 0x0A: case 0x15: case 0x18:
+                case 0x30: case 0x33: case 0x55: case 0x75: case 0x85:
+                    return false;
+            }
+            return true;
+        default:
+            return true;
+    }
+}
+
+// Does this instruction end a block? (Fx0A, Fx33 and Fx55 also do, but are
+// not translatable in the first place.)
+static bool endsBlock(u16 opcode)
+{
+    switch (opcode >> 12) {
+        case 0x0:
+            return opcode == 0x00EE;
+        case 0x1: case 0x2: case 0x3: case 0x4:
+        case 0x5: case 0x9: case 0xB: case 0xE:
+            return true;
+        default:
+            return false;
+    }
+}
+
+/*
+ * Just enough of an x86-64 assembler. All memory operands are [rdi + disp32],
+ * optionally with an index in rax.
+ */
+class Emitter {
+    public:
+        Emitter(u8 *p) : start(p), p(p) {}
+
+        u32 offset() const { return p - start; }
+
+        void byte(u8 x) { *p++ = x; }
+        void word(u16 x) { std::memcpy(p, &x, 2); p += 2; }
+        void dword(u32 x) { std::memcpy(p, &x, 4); p += 4; }
+
+        // ModRM for [rdi + disp32] with the given reg field
+        void mem(u8 reg, i32 disp) { byte(0x87 | (reg << 3)); dword(disp); }
+        // ModRM + SIB for [rdi + rax*scale + disp32]
+        void memIndexed(u8 reg, u8 scale, i32 disp) { byte(0x84 | (reg << 3)); byte((scale << 6) | 0x07); dword(disp); }
+
+        // Emit a rel32 jump/branch with the target filled in later; returns the offset of rel32
+        u32 jumpForward(u8 op1, u8 op2 = 0)
+        {
+            byte(op1);
+            if (op2)
+                byte(op2);
+            u32 site = offset();
+            dword(0);
+            return site;
+        }
+        // Point the rel32 at site to the current position
+        void patchHere(u32 site)
+        {
+            i32 rel = offset() - (site + 4);
+            std::memcpy(start + site, &rel, 4);
+        }
+
+        u8 *start, *p;
+};
+
+// Register numbers used in ModRM reg fields
+enum { AL = 0, CL = 1 };
+
+bool Jit::supported()
+{
+#ifdef JIT_SUPPORTED
+    return true;
+#else
+    return false;
+#endif
+}
+
+Jit::Jit(const Machine &m)
+{
+    const u8 *base = reinterpret_cast<const u8 *>(&m);
+    offV = reinterpret_cast<const u8 *>(&m.v[0]) - base;
+    offI = reinterpret_cast<const u8 *>(&m.I) - base;
+    offPc = reinterpret_cast<const u8 *>(&m.pc) - base;
+    offStack = reinterpret_cast<const u8 *>(&m.stack[0]) - base;
+    offStackptr = reinterpret_cast<const u8 *>(&m.stackptr) - base;
+    offKey = reinterpret_cast<const u8 *>(&m.key[0]) - base;
+    offRam = reinterpret_cast<const u8 *>(&m.ram[0]) - base;
+
+    arena = nullptr;
+#ifdef JIT_SUPPORTED
+    void *p = mmap(nullptr, arenaSize, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p != MAP_FAILED)
+        arena = static_cast<u8 *>(p);
+#endif
+
+    flush();
+}
+
+Jit::~Jit()
+{
+#ifdef JIT_SUPPORTED
+    if (arena)
+        munmap(arena, arenaSize);
+#endif
+}
+
+void Jit::flush()
+{
+    std::memset(code, 0, sizeof(code));
+    std::memset(hits, 0, sizeof(hits));
+    pending.clear();
+    used = 0;
+}
+
+// Point the jump at site to the translated block at target
+void Jit::link(u32 site, u16 target)
+{
+    u8 *entry = reinterpret_cast<u8 *>(code[target >> 1].fn);
+    i32 rel = entry - (arena + site + 4);
+    std::memcpy(arena + site, &rel, 4);
+}
+
+const JitCode *Jit::compile(Machine &m, u16 addr)
+{
+    if (!arena) {
+        hits[addr >> 1] = uncompilable;
+        return nullptr;
+    }
+    if (used + maxBlockBytes > arenaSize)
+        flush();
+
+    // Find out how many instructions go in this block
+    int count = 0;
+    u16 end = addr;
+    while (count < maxBlockLength && end < 0xFFF) {
+        u16 opcode = (m.ram[end] << 8) | m.ram[end + 1];
+        if (!translatable(opcode) || m.trapped(end, opcode))
+            break;
+        count++;
+        end += 2;
+        if (endsBlock(opcode))
+            break;
+    }
+    if (count == 0) {
+        hits[addr >> 1] = uncompilable;
+        return nullptr;
+    }
+
+    Emitter e(arena + used);
+    std::vector<PendingLink> exits;
+    QuirkFlags quirks = quirkFlags(m.quirks);
+
+    // Set PC to target and leave the block. The jump goes to the ret right
+    // after it until target gets translated, then it's linked straight to it.
+    auto exitTo = [&](u16 target) {
+        e.byte(0x66); e.byte(0xC7); e.mem(0, offPc); e.word(target);    // mov word [pc], target
+        u32 site = e.jumpForward(0xE9);                                   // jmp rel32
+        e.byte(0xC3);                                                     // ret
+        exits.push_back({ (u32)(used + site), target });
+    };
+
+    // Prologue: leave if the budget doesn't cover the whole block, otherwise take it
+    e.byte(0x48); e.byte(0x81); e.byte(0x3E); e.dword(count);           // cmp qword [rsi], count
+    u32 noBudget = e.jumpForward(0x0F, 0x8C);                           // jl  out
+    e.byte(0x48); e.byte(0x81); e.byte(0x2E); e.dword(count);           // sub qword [rsi], count
+
+    bool exited = false;
+    for (u16 a = addr; a < end; a += 2) {
+        opcodeBits bits;
+        bits.opcode = (m.ram[a] << 8) | m.ram[a + 1];
+        i32 vx = offV + bits.n.b;
+        i32 vy = offV + bits.n.c;
+        i32 vf = offV + 0xF;
+        u8 kk = bits.b.b;
+        u16 nnn = bits.t.b;
+
+        switch (bits.n.a) {
+            case 0x0:
+                if (bits.opcode == 0x00EE) {
+                    e.byte(0xFE); e.mem(1, offStackptr);                   // dec byte [sp]
+                    e.byte(0x80); e.mem(4, offStackptr); e.byte(0x0F);     // and byte [sp], 0xF
+                    e.byte(0x0F); e.byte(0xB6); e.mem(AL, offStackptr);    // movzx eax, byte [sp]
+                    e.byte(0x0F); e.byte(0xB7); e.memIndexed(AL, 1, offStack); // movzx eax, word [stack + rax*2]
+                    e.byte(0x83); e.byte(0xC0); e.byte(0x02);              // add eax, 2
+                    e.byte(0x66); e.byte(0x89); e.mem(AL, offPc);          // mov [pc], ax
+                    e.byte(0xC3);                                          // ret
+                    exited = true;
+                }
+                break;
+            case 0x1:
+                exitTo(nnn);
+                exited = true;
+                break;
+            case 0x2:
+                e.byte(0x0F); e.byte(0xB6); e.mem(AL, offStackptr);        // movzx eax, byte [sp]
+                e.byte(0x66); e.byte(0xC7); e.memIndexed(0, 1, offStack); e.word(a); // mov word [stack + rax*2], a
+                e.byte(0xFE); e.mem(0, offStackptr);                       // inc byte [sp]
+                e.byte(0x80); e.mem(4, offStackptr); e.byte(0x0F);         // and byte [sp], 0xF
+                exitTo(nnn);
+                exited = true;
+                break;
+            case 0x3:
+            case 0x4: {
+                e.byte(0x80); e.mem(7, vx); e.byte(kk);                    // cmp byte [vx], kk
+                u32 noSkip = e.jumpForward(0x0F, bits.n.a == 0x3 ? 0x85 : 0x84); // jne / je
+                exitTo(a + 4);
+                e.patchHere(noSkip);
+                exitTo(a + 2);
+                exited = true;
+                break;
+            }
+            case 0x5:
+            case 0x9: {
+                e.byte(0x8A); e.mem(AL, vx);                               // mov al, [vx]
+                e.byte(0x3A); e.mem(AL, vy);                               // cmp al, [vy]
+                u32 noSkip = e.jumpForward(0x0F, bits.n.a == 0x5 ? 0x85 : 0x84);
+                exitTo(a + 4);
+                e.patchHere(noSkip);
+                exitTo(a + 2);
+                exited = true;
+                break;
+            }
+            case 0x6:
+                e.byte(0xC6); e.mem(0, vx); e.byte(kk);                    // mov byte [vx], kk
+                break;
+            case 0x7:
+                e.byte(0x80); e.mem(0, vx); e.byte(kk);                    // add byte [vx], kk
+                break;
+            case 0x8:
+                switch (bits.n.d) {
+                    case 0x0:
+                        e.byte(0x8A); e.mem(AL, vy);                       // mov al, [vy]
+                        e.byte(0x88); e.mem(AL, vx);                       // mov [vx], al
+                        break;
+                    case 0x1:
+                    case 0x2:
+                    case 0x3:
+                        e.byte(0x8A); e.mem(AL, vy);                       // mov al, [vy]
+                        e.byte(bits.n.d == 1 ? 0x08 : bits.n.d == 2 ? 0x20 : 0x30);
+                        e.mem(AL, vx);                                     // or/and/xor [vx], al
+                        break;
+                    // The flag is written before the result, exactly like the
+                    // interpreter does, so VF as an operand behaves the same.
+                    case 0x4:
+                        e.byte(0x8A); e.mem(AL, vx);                       // mov al, [vx]
+                        e.byte(0x02); e.mem(AL, vy);                       // add al, [vy]
+                        e.byte(0x0F); e.byte(0x92); e.byte(0xC1);          // setc cl
+                        e.byte(0x88); e.mem(CL, vf);                       // mov [vf], cl
+                        e.byte(0x8A); e.mem(AL, vx);                       // mov al, [vx]
+                        e.byte(0x02); e.mem(AL, vy);                       // add al, [vy]
+                        e.byte(0x88); e.mem(AL, vx);                       // mov [vx], al
+                        break;
+                    case 0x5:
+                        e.byte(0x8A); e.mem(AL, vx);                       // mov al, [vx]
+                        e.byte(0x3A); e.mem(AL, vy);                       // cmp al, [vy]
+                        e.byte(0x0F); e.byte(0x97); e.byte(0xC1);          // seta cl
+                        e.byte(0x88); e.mem(CL, vf);                       // mov [vf], cl
+                        e.byte(0x8A); e.mem(AL, vx);                       // mov al, [vx]
+                        e.byte(0x2A); e.mem(AL, vy);                       // sub al, [vy]
+                        e.byte(0x88); e.mem(AL, vx);                       // mov [vx], al
+                        break;
+                    case 0x6:
+                        if (!quirks.shiftVy) {
+                            e.byte(0x8A); e.mem(AL, vx);                   // mov al, [vx]
+                            e.byte(0x24); e.byte(0x01);                    // and al, 1
+                            e.byte(0x88); e.mem(AL, vf);                   // mov [vf], al
+                            e.byte(0xD0); e.mem(5, vx);                    // shr byte [vx], 1
+                            break;
+                        }
+                        e.byte(0x8A); e.mem(AL, vy);                       // mov al, [vy]
+                        e.byte(0x24); e.byte(0x01);                        // and al, 1
+                        e.byte(0x88); e.mem(AL, vf);                       // mov [vf], al
+                        e.byte(0x8A); e.mem(AL, vy);                       // mov al, [vy]
+                        e.byte(0xD0); e.byte(0xE8);                        // shr al, 1
+                        e.byte(0x88); e.mem(AL, vx);                       // mov [vx], al
+                        break;
+                    case 0x7:
+                        e.byte(0x8A); e.mem(AL, vx);                       // mov al, [vx]
+                        e.byte(0x3A); e.mem(AL, vy);                       // cmp al, [vy]
+                        e.byte(0x0F); e.byte(0x96); e.byte(0xC1);          // setbe cl
+                        e.byte(0x88); e.mem(CL, vf);                       // mov [vf], cl
+                        e.byte(0x8A); e.mem(AL, vy);                       // mov al, [vy]
+                        e.byte(0x2A); e.mem(AL, vx);                       // sub al, [vx]
+                        e.byte(0x88); e.mem(AL, vx);                       // mov [vx], al
+                        break;
+                    case 0xE:
+                        if (!quirks.shiftVy) {
+                            e.byte(0x8A); e.mem(AL, vx);                   // mov al, [vx]
+                            e.byte(0xC0); e.byte(0xE8); e.byte(0x07);      // shr al, 7
+                            e.byte(0x88); e.mem(AL, vf);                   // mov [vf], al
+                            e.byte(0xD0); e.mem(4, vx);                    // shl byte [vx], 1
+                            break;
+                        }
+                        e.byte(0x8A); e.mem(AL, vy);                       // mov al, [vy]
+                        e.byte(0xC0); e.byte(0xE8); e.byte(0x07);          // shr al, 7
+                        e.byte(0x88); e.mem(AL, vf);                       // mov [vf], al
+                        e.byte(0x8A); e.mem(AL, vy);                       // mov al, [vy]
+                        e.byte(0x00); e.byte(0xC0);                        // add al, al
+                        e.byte(0x88); e.mem(AL, vx);                       // mov [vx], al
+                        break;
+                    default:
+                        break;
+                }
+                break;
+            case 0xA:
+                e.byte(0x66); e.byte(0xC7); e.mem(0, offI); e.word(nnn);   // mov word [I], nnn
+                break;
+            case 0xB:
+                e.byte(0x0F); e.byte(0xB6); e.mem(AL, quirks.jumpVx ? vx : offV); // movzx eax, byte [v0] / [vx]
+                e.byte(0x05); e.dword(nnn);                                // add eax, nnn
+                e.byte(0x66); e.byte(0x89); e.mem(AL, offPc);              // mov [pc], ax
+                e.byte(0xC3);                                              // ret
+                exited = true;
+                break;
+            case 0xE: {
+                if (kk != 0x9E && kk != 0xA1) {
+                    exitTo(a + 2);
+                    exited = true;
+                    break;
+                }
+                e.byte(0x0F); e.byte(0xB6); e.mem(AL, vx);                 // movzx eax, byte [vx]
+                e.byte(0x83); e.byte(0xE0); e.byte(0x0F);                  // and eax, 0xF
+                e.byte(0x80); e.memIndexed(7, 0, offKey); e.byte(0);       // cmp byte [key + rax], 0
+                u32 noSkip = e.jumpForward(0x0F, kk == 0x9E ? 0x84 : 0x85); // je / jne
+                exitTo(a + 4);
+                e.patchHere(noSkip);
+                exitTo(a + 2);
+                exited = true;
+                break;
+            }
+            case 0xF:
+                switch (kk) {
+                    case 0x1E:
+                        e.byte(0x0F); e.byte(0xB6); e.mem(AL, vx);         // movzx eax, byte [vx]
+                        e.byte(0x66); e.byte(0x01); e.mem(AL, offI);       // add [I], ax
+                        break;
+                    case 0x29:
+                        e.byte(0x0F); e.byte(0xB6); e.mem(AL, vx);         // movzx eax, byte [vx]
+                        e.byte(0x8D); e.byte(0x04); e.byte(0x80);          // lea eax, [rax + rax*4]
+                        e.byte(0x66); e.byte(0x89); e.mem(AL, offI);       // mov [I], ax
+                        break;
+                    case 0x65:
+                        for (int r = 0; r <= bits.n.b; r++) {
+                            e.byte(0x0F); e.byte(0xB7); e.mem(AL, offI);   // movzx eax, word [I]
+                            if (r) {
+                                e.byte(0x83); e.byte(0xC0); e.byte(r);     // add eax, r
+                            }
+                            e.byte(0x25); e.dword(0xFFF);                  // and eax, 0xFFF
+                            e.byte(0x0F); e.byte(0xB6); e.memIndexed(CL, 0, offRam); // movzx ecx, byte [ram + rax]
+                            e.byte(0x88); e.mem(CL, offV + r);             // mov [v + r], cl
+                        }
+                        if (!quirks.keepI) {
+                            e.byte(0x66); e.byte(0x81); e.mem(0, offI); e.word(bits.n.b + 1); // add word [I], x + 1
+                        }
+                        break;
+                    default:
+                        break;
+                }
+                break;
+            default:
+                break;
+        }
+    }
+
+    // Straight-line code ran into the length limit or an untranslatable instruction
+    if (!exited)
+        exitTo(end);
+
+    e.patchHere(noBudget);
+    e.byte(0xC3);                                                          // out: ret
+
+    JitCode &c = code[addr >> 1];
+    c.fn = reinterpret_cast<JitFn>(arena + used);
+    c.length = count;
+    used += e.offset();
+
+    for (u16 a = addr; a < end; a++)
+        m.codeMap[a] = true;
+
+    // Link exits of earlier blocks waiting for this one
+    for (size_t i = 0; i < pending.size(); ) {
+        if (pending[i].target == addr) {
+            link(pending[i].site, addr);
+            pending[i] = pending.back();
+            pending.pop_back();
+        } else {
+            i++;
+        }
+    }
+
+    // Link this block's exits to blocks that are already translated
+    for (auto &x : exits) {
+        if (x.target & 0xF001)
+            continue;
+        if (code[x.target >> 1].fn)
+            link(x.site, x.target);
+        else
+            pending.push_back(x);
+    }
+
+    return &c;
+}
@@ -0,0 +1,98 @@
+/*
+ *
+ * CHIPIT
+ *
+ * x86-64 dynamic recompiler.
+ *
+ * Hot basic blocks are translated to native code in an executable arena.
+ * The generated code works directly on the Machine it's called with
+ * (registers, I, PC and the stack are accessed as [rdi + offset]), and gets a
+ * pointer to the remaining instruction budget in rsi. Every block starts by
+ * checking the budget, so blocks can jump straight into each other (block
+ * linking) and still stop after the requested number of instructions.
+ *
+ * Instructions that aren't translated (Dxyn, Fx0A, Cxkk, 00E0, the timer
+ * instructions and everything that writes RAM) end a block and are run by the
+ * interpreter, and so does anything the debugger traps. Since translated code
+ * never writes RAM, any write to an address that has been translated simply
+ * throws the whole translation cache away.
+ */
+
+#ifndef JIT_H
+#define JIT_H
+
+#include <stdint.h>
+#include <vector>
+
+class Machine;
+
+// Translated code is called as fn(machine, &budget)
+typedef void (*JitFn)(Machine *m, int64_t *budget);
+
+struct JitCode {
+    JitFn fn;            // nullptr if not translated (yet)
+    uint16_t length;     // number of CHIP-8 instructions in the block
+};
+
+class Jit {
+    public:
+        Jit(const Machine &m);
+        ~Jit();
+
+        // Can we generate and run code on this host?
+        static bool supported();
+
+        // Translated code for the block starting at addr (even, below 0x1000),
+        // or nullptr. Blocks are translated once they've been asked for often enough.
+        const JitCode *get(Machine &m, uint16_t addr)
+        {
+            const JitCode *c = &code[addr >> 1];
+            if (c->fn)
+                return c;
+            if (hits[addr >> 1] == uncompilable || ++hits[addr >> 1] < hotThreshold)
+                return nullptr;
+            return compile(m, addr);
+        }
+
+        // Run translated code. Returns the number of instructions executed,
+        // which is at most budget.
+        int64_t run(Machine &m, const JitCode *c, int64_t budget)
+        {
+            int64_t left = budget;
+            c->fn(&m, &left);
+            return budget - left;
+        }
+
+        // Throw away all translated code
+        void flush();
+
+    private:
+        static const uint8_t hotThreshold = 8;
+        static const uint8_t uncompilable = 0xFF;
+        static const int maxBlockLength = 64;
+        static const size_t arenaSize = 1 << 20;
+        // Room needed to translate one block of maxBlockLength instructions
+        static const size_t maxBlockBytes = 16 * 1024;
+
+        const JitCode *compile(Machine &m, uint16_t addr);
+        void link(uint32_t site, uint16_t target);
+
+        // Offsets of the Machine members used by the generated code
+        int32_t offV, offI, offPc, offStack, offStackptr, offKey, offRam;
+
+        uint8_t *arena;
+        size_t used;
+
+        JitCode code[4096 / 2];
+        uint8_t hits[4096 / 2];
+
+        // Exits of translated blocks whose target hasn't been translated yet:
+        // offset of the jump's rel32 in the arena, and the target address
+        struct PendingLink {
+            uint32_t site;
+            uint16_t target;
+        };
+        std::vector<PendingLink> pending;
+};
+
+#endif
@@ -0,0 +1,520 @@
+/*
+ *
+ * CHIPIT
+ *
+ * Lockstep engine. See lockstep.h.
+ */
+
+#include <algorithm>
+#include <cstring>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define LOCKSTEP_AVX2 1
+// Compiled for AVX2 regardless of the build flags, only called if the host has it
+#define AVX2 __attribute__((target("avx2")))
+#endif
+
+#include "lockstep.h"
+
+Lockstep::Lockstep(int lanes)
+{
+    if (lanes < 1)
+        lanes = 1;
+    n = (lanes + groupSize - 1) / groupSize * groupSize;
+
+    ram.resize(4096 * n);
+    v.resize(16 * n);
+    stack.resize(16 * n);
+    stackptr.resize(n);
+    I.resize(n);
+    pc.resize(n);
+    delaytimer.resize(n);
+    soundtimer.resize(n);
+    key.resize(16 * n);
+    flags.resize(16 * n);
+    display.resize(n);
+    rng.resize(n);
+
+    cycles = 0;
+    cyclesPerFrame = 10;
+    frameCycles = 0;
+    quirks = Quirks::Modern;
+    uniformSteps = 0;
+    scalarSteps = 0;
+
+#ifdef LOCKSTEP_AVX2
+    avx2 = __builtin_cpu_supports("avx2");
+#else
+    avx2 = false;
+#endif
+}
+
+void Lockstep::fill(const Machine &m)
+{
+    for (int a = 0; a < 4096; a++)
+        std::fill_n(&ram[a * n], n, m.ram[a]);
+    for (int r = 0; r < 16; r++) {
+        std::fill_n(&v[r * n], n, m.v[r]);
+        std::fill_n(&stack[r * n], n, m.stack[r]);
+        std::fill_n(&key[r * n], n, m.key[r]);
+        std::fill_n(&flags[r * n], n, m.flags[r]);
+    }
+    std::fill(display.begin(), display.end(), m.display);
+
+    std::fill(stackptr.begin(), stackptr.end(), m.stackptr);
+    std::fill(I.begin(), I.end(), m.I);
+    std::fill(pc.begin(), pc.end(), m.pc);
+    std::fill(delaytimer.begin(), delaytimer.end(), m.delaytimer);
+    std::fill(soundtimer.begin(), soundtimer.end(), m.soundtimer);
+    std::fill(rng.begin(), rng.end(), m.rng);
+
+    cycles = m.cycles;
+    cyclesPerFrame = m.cyclesPerFrame;
+    frameCycles = m.frameCycles;
+    quirks = m.quirks;
+}
+
+void Lockstep::extract(int lane, Machine &m) const
+{
+    for (int a = 0; a < 4096; a++)
+        m.ram[a] = ram[a * n + lane];
+    for (int r = 0; r < 16; r++) {
+        m.v[r] = v[r * n + lane];
+        m.stack[r] = stack[r * n + lane];
+        m.key[r] = key[r * n + lane];
+        m.flags[r] = flags[r * n + lane];
+    }
+    m.display = display[lane];
+
+    m.stackptr = stackptr[lane];
+    m.I = I[lane];
+    m.pc = pc[lane];
+    m.delaytimer = delaytimer[lane];
+    m.soundtimer = soundtimer[lane];
+    m.rng = rng[lane];
+
+    m.cycles = cycles;
+    m.cyclesPerFrame = cyclesPerFrame;
+    m.frameCycles = frameCycles;
+    m.dirtyRows = ~0ull;
+    m.setQuirks(quirks);
+}
+
+void Lockstep::runCycles(u64 count)
+{
+    withQuirks(quirks, [&](auto policy) { run<decltype(policy)>(count); });
+}
+
+template <class Q>
+void Lockstep::run(u64 count)
+{
+    while (count) {
+        // Run up to the end of the frame, then tick the timers of all lanes
+        u64 chunk = frameCycles < cyclesPerFrame ? cyclesPerFrame - frameCycles : 1;
+        if (chunk > count)
+            chunk = count;
+
+        for (int base = 0; base < n; base += groupSize) {
+            for (u64 i = 0; i < chunk; i++)
+                stepGroup<Q>(base);
+        }
+
+        cycles += chunk;
+        frameCycles += chunk;
+        count -= chunk;
+        if (frameCycles >= cyclesPerFrame) {
+            frameCycles = 0;
+            tickTimers();
+        }
+    }
+}
+
+void Lockstep::runFrames(u64 count)
+{
+    for (u64 i = 0; i < count; i++)
+        runCycles(frameCycles < cyclesPerFrame ? cyclesPerFrame - frameCycles : 1);
+}
+
+void Lockstep::tickTimers()
+{
+    for (int lane = 0; lane < n; lane++) {
+        if (delaytimer[lane] > 0)
+            delaytimer[lane]--;
+        if (soundtimer[lane] > 0)
+            soundtimer[lane]--;
+    }
+}
+
+#ifdef LOCKSTEP_AVX2
+static AVX2 inline __m256i load(const void *p)
+{
+    return _mm256_loadu_si256(static_cast<const __m256i *>(p));
+}
+
+static AVX2 inline void store(void *p, __m256i x)
+{
+    _mm256_storeu_si256(static_cast<__m256i *>(p), x);
+}
+
+// Execute one instruction for the group of lanes starting at base, if they're
+// all at the same instruction and it has a group kernel. Returns false
+// without changing anything otherwise.
+template <class Q>
+AVX2 bool Lockstep::stepGroupAvx2(int base)
+{
+    u16 *p = &pc[base];
+    __m256i pcLo = load(p);
+    __m256i pcHi = load(p + 16);
+    u16 addr = p[0];
+    __m256i same = _mm256_and_si256(_mm256_cmpeq_epi16(pcLo, _mm256_set1_epi16(addr)),
+                                    _mm256_cmpeq_epi16(pcHi, _mm256_set1_epi16(addr)));
+    if (_mm256_movemask_epi8(same) != -1 || addr >= 0xFFF)
+        return false;
+
+    // Same PC, but the code may have been changed in some lanes
+    const u8 *hi = &ram[addr * n + base];
+    const u8 *lo = &ram[(addr + 1) * n + base];
+    same = _mm256_and_si256(_mm256_cmpeq_epi8(load(hi), _mm256_set1_epi8(hi[0])),
+                            _mm256_cmpeq_epi8(load(lo), _mm256_set1_epi8(lo[0])));
+    if (_mm256_movemask_epi8(same) != -1)
+        return false;
+
+    opcodeBits bits;
+    bits.opcode = (hi[0] << 8) | lo[0];
+    u8 kk = bits.b.b;
+    u8 *vx = &v[bits.n.b * n + base];
+    u8 *vy = &v[bits.n.c * n + base];
+    u8 *vf = &v[0xF * n + base];
+
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i one = _mm256_set1_epi8(1);
+    const __m256i ones = _mm256_set1_epi8(-1);
+    __m256i skip = zero;       // 0xFF in the lanes that skip the next instruction
+
+    switch (bits.n.a) {
+        case 0x0:
+            // Only 00E0 and 0nnn, which does nothing
+            if (bits.opcode == 0x00E0) {
+                for (int lane = base; lane < base + groupSize; lane++)
+                    display[lane].clear();
+            } else if (isScreenOp(bits.opcode) || bits.opcode == 0x00EE || bits.opcode == 0x00FD) {
+                return false;
+            }
+            break;
+        case 0x1:
+            store(p, _mm256_set1_epi16(bits.t.b));
+            store(p + 16, _mm256_set1_epi16(bits.t.b));
+            return true;
+        case 0x3:
+            skip = _mm256_cmpeq_epi8(load(vx), _mm256_set1_epi8(kk));
+            break;
+        case 0x4:
+            skip = _mm256_xor_si256(_mm256_cmpeq_epi8(load(vx), _mm256_set1_epi8(kk)), ones);
+            break;
+        case 0x5:
+            skip = _mm256_cmpeq_epi8(load(vx), load(vy));
+            break;
+        case 0x6:
+            store(vx, _mm256_set1_epi8(kk));
+            break;
+        case 0x7:
+            store(vx, _mm256_add_epi8(load(vx), _mm256_set1_epi8(kk)));
+            break;
+        case 0x8: {
+            // As in the interpreter, VF is written before the result, and the
+            // operands are loaded again in case one of them is VF.
+            __m256i a = load(vx), b = load(vy);
+            switch (bits.n.d) {
+                case 0x0: store(vx, b); break;
+                case 0x1: store(vx, _mm256_or_si256(a, b)); break;
+                case 0x2: store(vx, _mm256_and_si256(a, b)); break;
+                case 0x3: store(vx, _mm256_xor_si256(a, b)); break;
+                case 0x4:
+                    // Carry where the saturating sum differs from the wrapping one
+                    store(vf, _mm256_andnot_si256(_mm256_cmpeq_epi8(_mm256_adds_epu8(a, b), _mm256_add_epi8(a, b)), one));
+                    store(vx, _mm256_add_epi8(load(vx), load(vy)));
+                    break;
+                case 0x5:
+                    // Vx > Vy where the saturating difference isn't 0
+                    store(vf, _mm256_andnot_si256(_mm256_cmpeq_epi8(_mm256_subs_epu8(a, b), zero), one));
+                    store(vx, _mm256_sub_epi8(load(vx), load(vy)));
+                    break;
+                case 0x6:
+                    store(vf, _mm256_and_si256(Q::shiftVy ? b : a, one));
+                    store(vx, _mm256_and_si256(_mm256_srli_epi16(load(Q::shiftVy ? vy : vx), 1), _mm256_set1_epi8(0x7F)));
+                    break;
+                case 0x7:
+                    store(vf, _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_subs_epu8(a, b), zero), one));
+                    store(vx, _mm256_sub_epi8(load(vy), load(vx)));
+                    break;
+                case 0xE:
+                    store(vf, _mm256_and_si256(_mm256_srli_epi16(Q::shiftVy ? b : a, 7), one));
+                    a = load(Q::shiftVy ? vy : vx);
+                    store(vx, _mm256_add_epi8(a, a));
+                    break;
+                default:
+                    break;
+            }
+            break;
+        }
+        case 0x9:
+            skip = _mm256_xor_si256(_mm256_cmpeq_epi8(load(vx), load(vy)), ones);
+            break;
+        case 0xA:
+            store(&I[base], _mm256_set1_epi16(bits.t.b));
+            store(&I[base + 16], _mm256_set1_epi16(bits.t.b));
+            break;
+        case 0xF: {
+            __m256i x = load(vx);
+            __m256i xLo = _mm256_cvtepu8_epi16(_mm256_castsi256_si128(x));
+            __m256i xHi = _mm256_cvtepu8_epi16(_mm256_extracti128_si256(x, 1));
+            switch (kk) {
+                case 0x07: store(vx, load(&delaytimer[base])); break;
+                case 0x15: store(&delaytimer[base], x); break;
+                case 0x18: store(&soundtimer[base], x); break;
+                case 0x1E:
+                    store(&I[base], _mm256_add_epi16(load(&I[base]), xLo));
+                    store(&I[base + 16], _mm256_add_epi16(load(&I[base + 16]), xHi));
+                    break;
+                case 0x29:
+                    store(&I[base], _mm256_mullo_epi16(xLo, _mm256_set1_epi16(5)));
+                    store(&I[base + 16], _mm256_mullo_epi16(xHi, _mm256_set1_epi16(5)));
+                    break;
+                default:
+                    return false;
+            }
+            break;
+        }
+        default:
+            return false;
+    }
+
+    // PC += 2, or 4 in the lanes that skip
+    const __m256i two = _mm256_set1_epi16(2);
+    __m256i skipLo = _mm256_cvtepi8_epi16(_mm256_castsi256_si128(skip));
+    __m256i skipHi = _mm256_cvtepi8_epi16(_mm256_extracti128_si256(skip, 1));
+    store(p, _mm256_add_epi16(pcLo, _mm256_add_epi16(two, _mm256_and_si256(skipLo, two))));
+    store(p + 16, _mm256_add_epi16(pcHi, _mm256_add_epi16(two, _mm256_and_si256(skipHi, two))));
+    return true;
+}
+#else
+template <class Q>
+bool Lockstep::stepGroupAvx2(int base)
+{
+    return false;
+}
+#endif
+
+template <class Q>
+void Lockstep::stepGroup(int base)
+{
+    if (avx2 && stepGroupAvx2<Q>(base)) {
+        uniformSteps++;
+        return;
+    }
+
+    for (int lane = base; lane < base + groupSize; lane++)
+        stepLane<Q>(lane);
+    scalarSteps++;
+}
+
+// Same as Machine::drawSprite()
+template <class Q>
+void Lockstep::drawSprite(int lane, u8 vx, u8 vy, u8 h)
+{
+    u16 i = I[lane];
+    bool collision;
+    display[lane].draw<Q>(v[vx * n + lane], v[vy * n + lane], h,
+            [&](unsigned b) { return ram[((i + b) & 0xFFF) * n + lane]; }, collision);
+    v[0xF * n + lane] = collision;
+}
+
+// Execute one instruction in one lane, exactly like Machine::executeOpcode()
+template <class Q>
+void Lockstep::stepLane(int lane)
+{
+    auto V = [&](int r) -> u8 & { return v[r * n + lane]; };
+    auto RAM = [&](unsigned a) -> u8 & { return ram[(a & 0xFFF) * n + lane]; };
+    u16 &PC = pc[lane];
+    u16 &IR = I[lane];
+    u8 &SP = stackptr[lane];
+
+    opcodeBits bits;
+    bits.opcode = (RAM(PC) << 8) | RAM(PC + 1);
+    u8 x = bits.n.b, y = bits.n.c, kk = bits.b.b;
+    u16 nnn = bits.t.b;
+
+    switch (bits.n.a) {
+        case 0x0:
+            if (bits.opcode == 0x00E0) {
+                display[lane].clear();
+            } else if (bits.opcode == 0x00EE) {
+                SP = (SP - 1) & 0xF;
+                PC = stack[SP * n + lane];
+            } else if ((bits.opcode & 0xFFF0) == 0x00C0) {
+                display[lane].scrollDown(bits.n.d);
+            } else if ((bits.opcode & 0xFFF0) == 0x00D0) {
+                display[lane].scrollUp(bits.n.d);
+            } else if (bits.opcode == 0x00FB) {
+                display[lane].scrollRight();
+            } else if (bits.opcode == 0x00FC) {
+                display[lane].scrollLeft();
+            } else if (bits.opcode == 0x00FD) {
+                return;
+            } else if (bits.opcode == 0x00FE || bits.opcode == 0x00FF) {
+                display[lane].setHires(bits.opcode == 0x00FF);
+            }
+            break;
+        case 0x1:
+            PC = nnn;
+            return;
+        case 0x2:
+            stack[SP * n + lane] = PC;
+            SP = (SP + 1) & 0xF;
+            PC = nnn;
+            return;
+        case 0x3:
+            if (V(x) == kk)
+                PC += 2;
+            break;
+        case 0x4:
+            if (V(x) != kk)
+                PC += 2;
+            break;
+        case 0x5:
+            if (V(x) == V(y))
+                PC += 2;
+            break;
+        case 0x6:
+            V(x) = kk;
+            break;
+        case 0x7:
+            V(x) += kk;
+            break;
+        case 0x8:
+            switch (bits.n.d) {
+                case 0x0: V(x) = V(y); break;
+                case 0x1: V(x) |= V(y); break;
+                case 0x2: V(x) &= V(y); break;
+                case 0x3: V(x) ^= V(y); break;
+                case 0x4:
+                    V(0xF) = (V(x) + V(y)) > 0xFF;
+                    V(x) += V(y);
+                    break;
+                case 0x5:
+                    V(0xF) = V(x) > V(y);
+                    V(x) -= V(y);
+                    break;
+                case 0x6:
+                    V(0xF) = V(Q::shiftVy ? y : x) & 1;
+                    V(x) = V(Q::shiftVy ? y : x) >> 1;
+                    break;
+                case 0x7:
+                    V(0xF) = !(V(x) > V(y));
+                    V(x) = V(y) - V(x);
+                    break;
+                case 0xE:
+                    V(0xF) = V(Q::shiftVy ? y : x) >> 7;
+                    V(x) = V(Q::shiftVy ? y : x) << 1;
+                    break;
+                default:
+                    break;
+            }
+            break;
+        case 0x9:
+            if (V(x) != V(y))
+                PC += 2;
+            break;
+        case 0xA:
+            IR = nnn;
+            break;
+        case 0xB:
+            PC = V(Q::jumpVx ? x : 0x0) + nnn;
+            return;
+        case 0xC:
+            // Machine::nextRandom()
+            rng[lane] ^= rng[lane] << 13;
+            rng[lane] ^= rng[lane] >> 17;
+            rng[lane] ^= rng[lane] << 5;
+            V(x) = rng[lane] % (kk + 1);
+            break;
+        case 0xD:
+            drawSprite<Q>(lane, x, y, bits.n.d);
+            break;
+        case 0xE:
+            if (kk == 0x9E) {
+                if (key[(V(x) & 0xF) * n + lane])
+                    PC += 2;
+            } else if (kk == 0xA1) {
+                if (!key[(V(x) & 0xF) * n + lane])
+                    PC += 2;
+            }
+            break;
+        case 0xF:
+            switch (kk) {
+                case 0x01:
+                    display[lane].planes = x & 3;
+                    break;
+                case 0x07:
+                    V(x) = delaytimer[lane];
+                    break;
+                case 0x0A:
+                    for (int k = 0; k < 16; k++) {
+                        if (key[k * n + lane]) {
+                            V(0x0) = k;
+                            PC += 2;
+                            return;
+                        }
+                    }
+                    return;
+                case 0x15:
+                    delaytimer[lane] = V(x);
+                    break;
+                case 0x18:
+                    soundtimer[lane] = V(x);
+                    break;
+                case 0x1E:
+                    IR += V(x);
+                    break;
+                case 0x29:
+                    IR = V(x) * 5;
+                    break;
+                case 0x30:
+                    IR = bigFontAddr + (V(x) & 0xF) * 10;
+                    break;
+                case 0x33: {
+                    u8 vx = V(x);
+                    RAM(IR + 0) = vx / 100;
+                    RAM(IR + 1) = (vx / 10) % 10;
+                    RAM(IR + 2) = vx % 10;
+                    break;
+                }
+                case 0x55:
+                    for (int r = 0; r <= x; r++)
+                        RAM(IR + r) = V(r);
+                    if (!Q::keepI)
+                        IR += x + 1;
+                    break;
+                case 0x65:
+                    for (int r = 0; r <= x; r++)
+                        V(r) = RAM(IR + r);
+                    if (!Q::keepI)
+                        IR += x + 1;
+                    break;
+                case 0x75:
+                    for (int r = 0; r <= x; r++)
+                        flags[r * n + lane] = V(r);
+                    break;
+                case 0x85:
+                    for (int r = 0; r <= x; r++)
+                        V(r) = flags[r * n + lane];
+                    break;
+                default:
+                    break;
+            }
+            break;
+    }
+
+    PC += 2;
+}
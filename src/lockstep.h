@@ -0,0 +1,85 @@
+/*
+ *
+ * CHIPIT
+ *
+ * Lockstep engine: many copies of a machine, executed side by side.
+ *
+ * The state of all lanes (machines) is stored as a structure of arrays: all
+ * V0s next to each other, then all V1s, and so on for the stack, I, PC, the
+ * timers, the keys, the user flags and even RAM (ram[addr * lanes + lane]).
+ * Only the display is kept as a Framebuffer per lane: it's drawn to, scrolled
+ * and cleared one lane at a time anyway.
+ * Lanes are executed in groups of 32. When every lane of a group is at the
+ * same PC and sees the same opcode there, the instruction is executed for the
+ * whole group at once, with AVX2 if the host has it. Otherwise, and for
+ * instructions that have no group kernel, each lane is executed on its own.
+ *
+ * Every lane behaves exactly like a Machine running the same program with the
+ * reference interpreter (Machine::executeOpcode()), with the same quirks.
+ */
+
+#ifndef LOCKSTEP_H
+#define LOCKSTEP_H
+
+#include <vector>
+
+#include "machine.h"
+
+class Lockstep {
+    public:
+        // Lanes executed together
+        static const int groupSize = 32;
+
+        // The number of lanes is rounded up to a multiple of groupSize
+        explicit Lockstep(int lanes);
+
+        int lanes() const { return n; }
+
+        // Put the state of m in every lane. The lanes take its quirks too.
+        void fill(const Machine &m);
+        // Copy the state of one lane to m
+        void extract(int lane, Machine &m) const;
+
+        void setKey(int lane, int k, bool down) { key[k * n + lane] = down; }
+
+        // Every lane executes n instructions / n frames
+        void runCycles(u64 n);
+        void runFrames(u64 n);
+
+        // Instructions executed by every lane
+        u64 cycles;
+        int cyclesPerFrame;
+        int frameCycles;
+        Quirks quirks;
+
+        // Group instructions that were executed by a group kernel, and ones
+        // that had to be executed lane by lane
+        u64 uniformSteps;
+        u64 scalarSteps;
+
+    private:
+        template <class Q> void run(u64 count);
+        template <class Q> void stepGroup(int base);
+        template <class Q> bool stepGroupAvx2(int base);
+        template <class Q> void stepLane(int lane);
+        template <class Q> void drawSprite(int lane, u8 vx, u8 vy, u8 h);
+        void tickTimers();
+
+        int n;
+        bool avx2;
+
+        std::vector<u8> ram;            // [addr * n + lane]
+        std::vector<u8> v;              // [reg * n + lane]
+        std::vector<u16> stack;         // [level * n + lane]
+        std::vector<u8> stackptr;
+        std::vector<u16> I;
+        std::vector<u16> pc;
+        std::vector<u8> delaytimer;
+        std::vector<u8> soundtimer;
+        std::vector<u8> key;            // [key * n + lane]
+        std::vector<u8> flags;          // [flag * n + lane]
+        std::vector<Framebuffer> display;   // [lane]
+        std::vector<u32> rng;
+};
+
+#endif
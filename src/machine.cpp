@@ -0,0 +1,703 @@
+/*
+ *
+ * CHIPIT
+ *
+ * The CHIP-8 machine core.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <cstring>
+
+#include "machine.h"
+#include "profile.h"
+#include "debugger.h"
+#include "aot.h"
+
+// The font sprites
+static const u8 font[16][5] = {
+    { 0xF0, 0x90, 0x90, 0x90, 0xF0 },  // 0
+    { 0x20, 0x60, 0x20, 0x20, 0x70 },  // 1
+    { 0xF0, 0x10, 0xF0, 0x80, 0xF0 },  // etc..
+    { 0xF0, 0x10, 0xF0, 0x10, 0xF0 },
+    { 0x90, 0x90, 0xF0, 0x10, 0x10 },
+    { 0xF0, 0x80, 0xF0, 0x10, 0xF0 },
+    { 0xF0, 0x80, 0xF0, 0x90, 0xF0 },
+    { 0xF0, 0x10, 0x20, 0x40, 0x40 },
+    { 0xF0, 0x90, 0xF0, 0x90, 0xF0 },
+    { 0xF0, 0x90, 0xF0, 0x10, 0xF0 },
+    { 0xF0, 0x90, 0xF0, 0x90, 0x90 },
+    { 0xE0, 0x90, 0xE0, 0x90, 0xE0 },
+    { 0xF0, 0x80, 0x80, 0x80, 0xF0 },
+    { 0xE0, 0x90, 0x90, 0x90, 0xE0 },
+    { 0xF0, 0x80, 0xF0, 0x80, 0xF0 },
+    { 0xF0, 0x80, 0xF0, 0x80, 0x80 }
+};
+
+// The big 8x10 font sprites of the SUPER-CHIP, with XO-CHIP's A - F
+static const u8 bigFont[16][10] = {
+    { 0xFF, 0xFF, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF },  // 0
+    { 0x18, 0x78, 0x78, 0x18, 0x18, 0x18, 0x18, 0x18, 0xFF, 0xFF },  // 1
+    { 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF },  // etc..
+    { 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF },
+    { 0xC3, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0x03, 0x03, 0x03, 0x03 },
+    { 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF },
+    { 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF },
+    { 0xFF, 0xFF, 0x03, 0x03, 0x06, 0x0C, 0x18, 0x18, 0x18, 0x18 },
+    { 0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF },
+    { 0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF },
+    { 0x7E, 0xFF, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xC3 },
+    { 0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC },
+    { 0x3C, 0xFF, 0xC3, 0xC0, 0xC0, 0xC0, 0xC0, 0xC3, 0xFF, 0x3C },
+    { 0xFC, 0xFE, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFE, 0xFC },
+    { 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF },
+    { 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xC0, 0xC0 }
+};
+
+Machine::Machine()
+{
+    cyclesPerFrame = 10;
+    engine = Engine::Predecode;
+    quirks = Quirks::Modern;
+    seed = 0x2545F491;
+    profiler = nullptr;
+    debugger = nullptr;
+    reset();
+}
+
+// Put the machine in its power-on state. RAM is cleared and the font reloaded,
+// so a ROM has to be (re)loaded afterwards.
+void Machine::reset()
+{
+    // Clearing the struct as a whole also clears its padding, so equal
+    // states are equal byte for byte (see Rewind)
+    std::memset(static_cast<MachineState *>(this), 0, sizeof(MachineState));
+    pc = 0x200;
+    // xorshift gets stuck at 0
+    rng = seed ? seed : 1;
+    display.planes = 1;
+
+    // The whole screen has to be drawn after a reset, not just what was on it
+    dirtyRows = ~0ull;
+    stopped = false;
+
+    loadFont();
+    invalidateCode();
+}
+
+// Drop all predecoded instructions. Needed after RAM has been changed behind
+// the machine's back, e.g. when loading a program.
+void Machine::invalidateCode()
+{
+    for (auto &d : decoded)
+        d.fn = opDecode;
+    if (blocks)
+        blocks->clear();
+    if (jit)
+        jit->flush();
+    codeMap.reset();
+    aotValid = checkAot();
+}
+
+void Machine::setQuirks(Quirks q)
+{
+    quirks = q;
+    invalidateCode();
+}
+
+// Does RAM hold the code of the program translated ahead of time, as far as
+// it was translated, and is it run with the quirks it was translated for? If so, writes to that code are watched from now on.
+bool Machine::checkAot()
+{
+    if (engine != Engine::Aot || !aotProgram || quirks != aotProgram->quirks)
+        return false;
+
+    const AotProgram &p = *aotProgram;
+    for (int a = 0x200; a < 0x200 + p.size; a++) {
+        if ((p.covered[a >> 3] >> (a & 7) & 1) && ram[a] != p.rom[a - 0x200])
+            return false;
+    }
+    for (int a = 0x200; a < 0x200 + p.size; a++) {
+        if (p.covered[a >> 3] >> (a & 7) & 1)
+            codeMap[a] = true;
+    }
+    return true;
+}
+
+// The program wrote to an address that's part of a block or translated code
+void Machine::codeWritten(u16 addr)
+{
+    if (blocks)
+        blocks->invalidate(addr);
+    if (jit)
+        jit->flush();
+    aotValid = false;
+}
+
+bool Machine::trapped(u16 addr, u16 opcode) const
+{
+    return debugger && debugger->traps(addr, opcode);
+}
+
+void Machine::loadFont()
+{
+    for (int i = 0; i < 16; i++) {
+        std::memcpy(&ram[i*5], font[i], 5*sizeof(u8));
+        std::memcpy(&ram[bigFontAddr + i*10], bigFont[i], 10*sizeof(u8));
+    }
+}
+
+// Load a program into RAM at 0x200. Returns the number of bytes loaded.
+int Machine::loadRom(const u8 *data, int size)
+{
+    if (size > (int)sizeof(ram) - 0x200)
+        size = sizeof(ram) - 0x200;
+    std::memcpy(&ram[0x200], data, size);
+    invalidateCode();
+    return size;
+}
+
+// Load a program into RAM at 0x200. Returns the number of bytes loaded, or -1 on error.
+int Machine::loadRom(const char *filename)
+{
+    FILE *f;
+    int filesize = 0;
+
+    f = fopen(filename, "rb");
+    if (!f)
+        return -1;
+
+    fseek(f, 0L, SEEK_END);
+    filesize = ftell(f);
+    fseek(f, 0L, SEEK_SET);
+
+    if (filesize > (int)sizeof(ram) - 0x200)
+        filesize = sizeof(ram) - 0x200;
+    if (fread(&ram[0x200], filesize, 1, f) != 1)
+        filesize = -1;
+
+    fclose(f);
+    invalidateCode();
+    return filesize;
+}
+
+void Machine::restore(const MachineState &s)
+{
+    // Drop cached code wherever RAM changes, 8 bytes at a time
+    for (int a = 0; a < 4096; a += 8) {
+        u64 now, then;
+        std::memcpy(&now, ram + a, 8);
+        std::memcpy(&then, s.ram + a, 8);
+        if (now == then)
+            continue;
+        for (int b = a; b < a + 8; b++) {
+            if (ram[b] == s.ram[b])
+                continue;
+            decoded[b >> 1].fn = opDecode;
+            if (codeMap[b])
+                codeWritten(b);
+        }
+    }
+
+    for (int y = 0; y < Framebuffer::height; y++) {
+        for (int p = 0; p < Framebuffer::planeCount; p++) {
+            if (display.row(p, y) != s.display.row(p, y))
+                dirtyRows |= 1ull << y;
+        }
+    }
+
+    static_cast<MachineState &>(*this) = s;
+    // Whatever the debugger stopped on is gone
+    stopped = false;
+    // The state may have the translated program's code back
+    if (!aotValid)
+        aotValid = checkAot();
+}
+
+u64 Machine::stateHash() const
+{
+    const u8 *p = reinterpret_cast<const u8 *>(static_cast<const MachineState *>(this));
+    u64 h = 0xcbf29ce484222325ull;
+    for (size_t i = 0; i < sizeof(MachineState); i++) {
+        h ^= p[i];
+        h *= 0x100000001b3ull;
+    }
+    return h;
+}
+
+// Save state files are a small header followed by the MachineState as is
+struct StateHeader {
+    char magic[8];
+    u32 size;
+};
+static const char stateMagic[8] = { 'C', 'H', 'I', 'P', 'I', 'T', 'S', 'T' };
+
+bool Machine::saveState(const char *filename) const
+{
+    FILE *f = fopen(filename, "wb");
+    if (!f)
+        return false;
+
+    StateHeader h;
+    std::memcpy(h.magic, stateMagic, sizeof(h.magic));
+    h.size = sizeof(MachineState);
+    const MachineState &s = *this;
+    bool ok = fwrite(&h, sizeof(h), 1, f) == 1 && fwrite(&s, sizeof(s), 1, f) == 1;
+
+    return fclose(f) == 0 && ok;
+}
+
+bool Machine::loadState(const char *filename)
+{
+    FILE *f = fopen(filename, "rb");
+    if (!f)
+        return false;
+
+    StateHeader h;
+    MachineState s;
+    bool ok = fread(&h, sizeof(h), 1, f) == 1
+        && std::memcmp(h.magic, stateMagic, sizeof(h.magic)) == 0
+        && h.size == sizeof(MachineState)
+        && fread(&s, sizeof(s), 1, f) == 1;
+    fclose(f);
+
+    if (ok)
+        restore(s);
+    return ok;
+}
+
+// Execute one instruction. The timers are ticked if it completes a frame.
+void Machine::step()
+{
+    if (profiler)
+        profiler->count(*this);
+    if ((engine == Engine::Switch && !debugger) || profiler)
+        pc += executeOpcode();
+    else if (engine == Engine::Table && !debugger)
+        pc += executeTable();
+    else
+        pc += executeDecoded();
+    cycles++;
+    endCycles(1);
+}
+
+// Execute n instructions. The timers are ticked once for every frame of
+// cyclesPerFrame instructions completed.
+//
+// Blocks and translated code may run across a frame boundary, with the timers
+// only ticked afterwards. That's fine because they never contain Fx07, Fx15
+// or Fx18: an instruction that uses the timers is always run on its own, at
+// which point the ticks of all frames before it have been applied.
+void Machine::runCycles(u64 n)
+{
+    // Pick the instantiation for the quirks once, not for every instruction
+    withQuirks(quirks, [&](auto policy) { run<decltype(policy)>(n); });
+}
+
+template <class Q>
+void Machine::run(u64 n)
+{
+    // Pick the engine once, not for every instruction. Profiling is an
+    // engine of its own, so it costs nothing when it's off. The debugger
+    // works through the predecoded cache, so it takes over from the switch,
+    // table and aot engines, and so does a program that isn't the one
+    // translated ahead of time.
+    if (profiler) {
+        for (u64 i = 0; i < n; i++) {
+            profiler->count(*this);
+            pc += executeOpcode<Q>();
+            endCycles(1);
+        }
+    } else if (engine == Engine::Switch && !debugger) {
+        for (u64 i = 0; i < n; i++) {
+            pc += executeOpcode<Q>();
+            endCycles(1);
+        }
+    } else if (engine == Engine::Table && !debugger) {
+        for (u64 i = 0; i < n; i++) {
+            pc += executeTable();
+            endCycles(1);
+        }
+    } else if (engine == Engine::Aot && aotValid && !debugger) {
+        u64 i = 0;
+        while (i < n) {
+            // Interpret where there's no translated code, and everything
+            // once the program has written to its code
+            i64 done = aotValid ? aotProgram->run(*this, n - i) : 0;
+            if (done) {
+                endCycles(done);
+                i += done;
+            } else {
+                pc += executeDecoded();
+                endCycles(1);
+                i++;
+            }
+        }
+    } else if (engine == Engine::Predecode || engine == Engine::Switch || engine == Engine::Table
+            || engine == Engine::Aot) {
+        for (u64 i = 0; i < n; i++) {
+            pc += executeDecoded();
+            endCycles(1);
+        }
+    } else if (engine == Engine::Jit) {
+        if (!jit)
+            jit.reset(new Jit(*this));
+
+        u64 i = 0;
+        while (i < n) {
+            const JitCode *c = (pc & 0xF001) ? nullptr : jit->get(*this, pc);
+            // Interpret where there's no translated code (yet) or it
+            // can't even run its first block within n
+            if (c && c->length <= n - i) {
+                i64 done = jit->run(*this, c, n - i);
+                endCycles(done);
+                i += done;
+            } else {
+                pc += executeDecoded();
+                endCycles(1);
+                i++;
+            }
+        }
+    } else {
+        if (!blocks)
+            blocks.reset(new BlockCache);
+
+        u64 i = 0;
+        while (i < n) {
+            Block *b = (pc & 0xF001) ? nullptr : blocks->get(*this, pc);
+            // Run single instructions if there's no block here, or if it
+            // would take us past n
+            if (b && b->length && b->length <= n - i) {
+                runBlock(*b);
+                endCycles(b->length);
+                i += b->length;
+            } else {
+                pc += executeDecoded();
+                endCycles(1);
+                i++;
+            }
+        }
+    }
+    cycles += n;
+}
+
+// Run until the end of the current frame
+void Machine::runFrame()
+{
+    runCycles(frameCycles < cyclesPerFrame ? cyclesPerFrame - frameCycles : 1);
+}
+
+void Machine::runFrames(u64 n)
+{
+    for (u64 i = 0; i < n; i++)
+        runFrame();
+}
+
+// fmt::print("D{0:X}{1:X}{2:X}: Draw sprite at V{0:X},V{1:X} with height {2:d} pixels.", bits.n.b, bits.n.c, bits.n.d);
+// Dxyn - DRW Vx, Vy, nibble
+// Display n-byte sprite starting at memory location I at (Vx, Vy), set VF = collision.
+// The interpreter reads n bytes from memory, starting at the address stored in I. These bytes are then displayed as sprites on
+// screen at coordinates (Vx, Vy). Sprites are XORed onto the existing screen. If this causes any pixels to be erased,
+// VF is set to 1, otherwise it is set to 0. If the sprite is positioned so part of it is outside the coordinates of the display,
+// it wraps around to the opposite side of the screen. 
+//
+// The SUPER-CHIP draws 16x16 sprites with Dxy0, and XO-CHIP draws a sprite
+// into each selected plane, see Framebuffer::draw(). Each sprite row is
+// shifted into place once, so it can be checked for collisions and drawn
+// with an AND and an XOR on each half of the display row. With the clip
+// quirk, the sprite still starts at (Vx, Vy) wrapped into the screen, but
+// whatever sticks out on the right or the bottom isn't drawn.
+template <class Q>
+void Machine::drawSprite(u8 vx, u8 vy, u8 h)
+{
+    bool collision;
+    u16 i = I;
+    dirtyRows |= display.draw<Q>(v[vx], v[vy], h, [&](unsigned b) { return ram[(i + b) & 0xFFF]; }, collision);
+    v[0xF] = collision;
+}
+
+template void Machine::drawSprite<ModernQuirks>(u8 vx, u8 vy, u8 h);
+template void Machine::drawSprite<CosmacQuirks>(u8 vx, u8 vy, u8 h);
+template void Machine::drawSprite<SchipQuirks>(u8 vx, u8 vy, u8 h);
+template void Machine::drawSprite<XochipQuirks>(u8 vx, u8 vy, u8 h);
+
+void Machine::drawSprite(u8 vx, u8 vy, u8 h)
+{
+    withQuirks(quirks, [&](auto policy) { drawSprite<decltype(policy)>(vx, vy, h); });
+}
+
+int Machine::executeOpcode()
+{
+    int advance = 0;
+    withQuirks(quirks, [&](auto policy) { advance = executeOpcode<decltype(policy)>(); });
+    return advance;
+}
+
+template <class Q>
+int Machine::executeOpcode()
+{
+    //uint16_t opcode = (ram[pc] << 8) | ram[pc+1];
+    opcodeBits bits;
+    bits.opcode = (ram[pc & 0xFFF] << 8) | ram[(pc+1) & 0xFFF];
+    //const uint16_t &opcode = bits.opcode;
+
+    if(bits.b.a == 0 && bits.b.b == 0) {
+        //if (verbose) fmt::print("{0:0>2X}{1:0>2X}\n", BA(opcode), BB(opcode));
+        return 2;
+    }
+
+    switch (bits.n.a) {                      // check the first nibble (highest 4 bits)
+        case 0:
+            if(bits.n.b == 0) {
+                if(bits.b.b == 0xE0) {       // Clear the screen
+                    //if (verbose) fmt::print("00E0: Clear the screen");
+                    clearDisplay();
+                    //window.clear(sf::Color::Black);
+                }
+                if(bits.b.b == 0xEE) {       // Return from subroutine
+                    //if (verbose) fmt::print("00EE: Return from subroutine");
+                    stackptr = (stackptr - 1) & 0xF;
+                    pc = stack[stackptr];
+                }
+                // SUPER-CHIP and XO-CHIP screen instructions
+                if(bits.n.c == 0xC)          // 00Cn - Scroll down n pixels
+                    scrollDown(bits.n.d);
+                if(bits.n.c == 0xD)          // 00Dn - Scroll up n pixels
+                    scrollUp(bits.n.d);
+                if(bits.b.b == 0xFB)         // Scroll right 4 pixels
+                    scrollRight();
+                if(bits.b.b == 0xFC)         // Scroll left 4 pixels
+                    scrollLeft();
+                if(bits.b.b == 0xFD)         // Exit. There's nothing to exit to, so stay here.
+                    return 0;
+                if(bits.b.b == 0xFE)         // Low resolution
+                    setHires(false);
+                if(bits.b.b == 0xFF)         // High resolution
+                    setHires(true);
+            } else {
+                //fmt::print("0{0:0>3X}: Call RCA 1802 program at address {0:0>3X} NOT IMPLEMENTED\n", L3(opcode));
+            }
+            break;
+        case 1:
+            //if (verbose) fmt::print("1{0:X}: Jump to address {0:#x}", L3(opcode));
+            pc = bits.t.b;
+            //if (verbose) fmt::print("\n");
+            return 0;
+            break;
+        case 2:
+            //if (verbose) fmt::print("2{0:0>3X}: Call subroutine at address {0:0>3x}", L3(opcode));
+            // Push current PC to the stack
+            stack[stackptr] = pc;
+            stackptr = (stackptr + 1) & 0xF;
+            // Jump to subroutine
+            pc = bits.t.b;
+            //if (verbose) fmt::print("\n");
+            return 0;
+            break;
+        case 3:
+            //if (verbose) fmt::print("3{0:X}{1:0>2X}: Skip next instruction if V{0:X} == {1:X}", NB(opcode), BB(opcode));
+            if (v[bits.n.b] == bits.b.b)
+                pc += 2;
+            break;
+        case 4:
+            //if (verbose) fmt::print("4{0:X}{1:0>2X}: Skip next instruction if V{0:X} != {1:X}", NB(opcode), BB(opcode));
+            if (v[bits.n.b] != bits.b.b)
+                pc += 2;
+            break;
+        case 5:
+            //if (verbose) fmt::print("5{0:X}{1:X}0: Skip next instruction if V{0:X} == V{1:X}", NB(opcode), NC(opcode));
+            if (v[bits.n.b] == v[bits.n.c])
+                pc += 2;
+            break;
+        case 6:
+            //if (verbose) fmt::print("6{0:X}{1:0>2X}: V{0:X} = {1:X}", NB(opcode), BB(opcode));
+            v[bits.n.b] = bits.b.b;
+            break;
+        case 7:
+            //if (verbose) fmt::print("7{0:X}{1:0>2X}: V{0:X} += {1:X}", NB(opcode), BB(opcode));
+            v[bits.n.b] += bits.b.b;
+            break;
+        case 8:
+            switch(bits.n.d) {
+                case 0x0:
+                    //if (verbose) fmt::print("8{0:X}{1:X}0: V{0:X} = V{1:X}", NB(opcode), NC(opcode));
+                    v[bits.n.b] = v[bits.n.c];
+                    break; 
+                case 0x1:
+                    //if (verbose) fmt::print("8{0:X}{1:X}1: V{0:X} = V{0:X} OR V{1:X} (bitwise OR)", NB(opcode), NC(opcode));
+                    v[bits.n.b] |= v[bits.n.c];
+                    break; 
+                case 0x2:
+                    //if (verbose) fmt::print("8{0:X}{1:X}2: V{0:X} = V{0:X} AND V{1:X} (bitwise AND)", NB(opcode), NC(opcode));
+                    v[bits.n.b] &= v[bits.n.c];
+                    break; 
+                case 0x3:
+                    //if (verbose) fmt::print("8{0:X}{1:X}3: V{0:X} = V{0:X} XOR V{1:X} (bitwise XOR)", NB(opcode), NC(opcode));
+                    v[bits.n.b] ^= v[bits.n.c];
+                    break; 
+                case 0x4:
+                    //if (verbose) fmt::print("8{0:X}{1:X}4: V{0:X} += V{1:X} - VF set to 1 when there's a carry.", NB(opcode), NC(opcode));
+                    if ((v[bits.n.b] + v[bits.n.c]) > 0xFF)
+                        v[0xF] = 1;
+                    else
+                        v[0xF] = 0;
+                    v[bits.n.b] += v[bits.n.c];
+                    break; 
+                case 0x5:
+                    //if (verbose) fmt::print("8{0:X}{1:X}5: V{0:X} -= V{1:X} - VF set to 0 when there's a borrow, 1 if not.", NB(opcode), NC(opcode));
+                    if (v[bits.n.b] > v[bits.n.c])
+                        v[0xF] = 1;
+                    else
+                        v[0xF] = 0;
+                    v[bits.n.b] -= v[bits.n.c];
+                    break; 
+                case 0x6:
+                    //if (verbose) fmt::print("8{0:X}{1:X}6: V{0:X} >>= 1. VF is set to the value of the LSB of V{0:X} before the shift.", NB(opcode), NC(opcode));
+                    // With the shift quirk, Vx = Vy >> 1
+                    if (v[Q::shiftVy ? bits.n.c : bits.n.b] & 1)
+                        v[0xF] = 1;
+                    else
+                        v[0xF] = 0;
+                    v[bits.n.b] = v[Q::shiftVy ? bits.n.c : bits.n.b] >> 1;
+                    break; 
+                case 0x7:
+                    //if (verbose) fmt::print("8{0:X}{1:X}7: V{0:X} = V{1:X} - V{0:X}. VF is set to 0 when there's a borrow.", NB(opcode), NC(opcode));
+                    if (v[bits.n.b] > v[bits.n.c])
+                        v[0xF] = 0;
+                    else
+                        v[0xF] = 1;
+                    v[bits.n.b] = v[bits.n.c] - v[bits.n.b];
+                    break; 
+                case 0xE:
+                    //if (verbose) fmt::print("8{0:X}{1:X}6: V{0:X} <<= 1. VF is set to the value of the MSB of V{0:X} before the shift.", NB(opcode), NC(opcode));
+                    v[0xF] = (v[Q::shiftVy ? bits.n.c : bits.n.b] >> 7);
+                    v[bits.n.b] = v[Q::shiftVy ? bits.n.c : bits.n.b] << 1;
+                    break; 
+                default:
+                    break;
+            }
+            break;
+        case 9:
+            //if (verbose) fmt::print("9{0:X}{1:X}0: Skip next instruction if V{0:X} != V{1:X}", NB(opcode), NC(opcode));
+            if (v[bits.n.b] != v[bits.n.c])
+                pc += 2;
+            break;
+        case 0xA:
+            //if (verbose) fmt::print("A{0:0>3X}: Set I to the address {0:0>3X}", L3(opcode));
+            I = bits.t.b;
+            break;
+        case 0xB:
+            //if (verbose) fmt::print("B{0:0>3X}: PC = V0 + {0:0>3X} (jump to address {0:0>3X} + V0)\n", L3(opcode));
+            // With the jump quirk, Bxnn jumps to xnn + Vx
+            pc = v[Q::jumpVx ? bits.n.b : 0x0] + bits.t.b;
+            return 0;
+            break;
+        case 0xC:
+            //if (verbose) fmt::print("C{0:X}{1:0>2X}: V{0:X} = rand() & {1:X}", NB(opcode), L3(opcode));
+            v[bits.n.b] = nextRandom() % (bits.b.b + 1);
+            break;
+        case 0xD: // TODO
+            //if (verbose) fmt::print("D{0:X}{1:X}{2:X}: Draw sprite at V{0:X},V{1:X} with height {2:d} pixels.", NB(opcode), NC(opcode), ND(opcode));
+            drawSprite<Q>(bits.n.b, bits.n.c, bits.n.d);
+            break;
+        case 0xE:
+            if(bits.b.b == 0x9E) {
+                //if (verbose) fmt::print("E{0:X}9E: Skip next instruction if key stored in V{0:X} ({1:X}) is pressed.", NB(opcode), v[bits.n.b]);
+                if(key[v[bits.n.b] & 0xF])
+                    pc += 2;
+            }
+            if(bits.b.b == 0xA1) {
+                //if (verbose) fmt::print("E{0:X}A1: Skip next instruction if key stored in V{0:X} is not pressed.", NB(opcode));
+                if(!key[v[bits.n.b] & 0xF])
+                    pc += 2;
+            }
+            break;
+        case 0xF:
+            switch (bits.b.b) {
+                case 0x01:
+                    // Fn01: select the planes to draw to (XO-CHIP). n is a bit mask, not a register.
+                    display.planes = bits.n.b & 3;
+                    break;
+                case 0x07:
+                    //if (verbose) fmt::print("F{0:X}07: Set V{0:X} to the value of the delay timer.", NB(opcode));
+                    v[bits.n.b] = delaytimer;
+                    break;
+                case 0x0A: {
+                               //if (verbose) fmt::print("F{0:X}0A: Wait for keypress and store it in V{0:X}. Blocking operation - all instruction halted until next key event.\n", NB(opcode));
+                               bool keyPressed = false;
+                               for (int i = 0; i < 16; i++) {
+                                   if (key[i]) {
+                                       v[0x0] = i;
+                                       keyPressed = true;
+                                       //if (verbose) fmt::print("KEY PRESSED: {0:X} V0 is now: {1:X}\n", i, V0);
+                                       return 2;
+                                   }
+                               }
+                               if(!keyPressed)
+                                   return 0;
+                           }
+                    break;
+                case 0x15:
+                    //if (verbose) fmt::print("F{0:X}15: Set delay timer to V{0:X}", NB(opcode));
+                    delaytimer = v[bits.n.b];
+                    break;
+                case 0x18:
+                    //if (verbose) fmt::print("F{0:X}18: Set sound timer to V{0:X}", NB(opcode));
+                    soundtimer = v[bits.n.b];
+                    break;
+                case 0x1E:
+                    //if (verbose) fmt::print("F{0:X}1E: I += V{0:X}", NB(opcode));
+                    I += v[bits.n.b];
+                    break;
+                case 0x29:
+                    //if (verbose) fmt::print("F{0:X}29: Set I to the location of the sprite for the character in V{0:X}", NB(opcode));
+                    I = v[bits.n.b] * 5;
+                    break;
+                case 0x30:
+                    // Set I to the big font sprite for the digit in Vx (SUPER-CHIP)
+                    I = bigFontAddr + (v[bits.n.b] & 0xF) * 10;
+                    break;
+                case 0x33:
+                    //if (verbose) fmt::print("F{0:X}33: BCD(V{0:X}) - store binary coded decimal representation of V{0:X} at address I ({1:X})", NB(opcode), I);
+                    writeRam(I+0,  v[bits.n.b] / 100);
+                    writeRam(I+1, (v[bits.n.b] /  10) % 10);
+                    writeRam(I+2, (v[bits.n.b] % 100) % 10);
+                    break;
+                case 0x55:
+                    //if (verbose) fmt::print("F{0:X}55: Store V0-V{0:X} in memory starting at address in I. I += 1 for each value written.", NB(opcode));
+                    for(int r = 0; r <= bits.n.b; r++)
+                        writeRam(I + r, v[r]);
+                    // With the load/store quirk, I stays where it is
+                    if (!Q::keepI)
+                        I += bits.n.b + 1;
+                    break;
+                case 0x65:
+                    //if (verbose) fmt::print("F{0:X}66: Load V0-V{0:X} with values from memory starting at address in I. I += 1 for each value read.", NB(opcode));
+                    for(int r = 0; r <= bits.n.b; r++)
+                        v[r] = ram[(I + r) & 0xFFF];
+                    if (!Q::keepI)
+                        I += bits.n.b + 1;
+                    break;
+                case 0x75:
+                    // Store V0 - Vx in the user flags (SUPER-CHIP)
+                    for(int r = 0; r <= bits.n.b; r++)
+                        flags[r] = v[r];
+                    break;
+                case 0x85:
+                    // Load V0 - Vx from the user flags (SUPER-CHIP)
+                    for(int r = 0; r <= bits.n.b; r++)
+                        v[r] = flags[r];
+                    break;
+
+                default:
+                    break;
+            }
+            break;
+        default:
+            break;
+    }
+    //if (verbose) fmt::print("\n");
+
+
+    return 2;
+}
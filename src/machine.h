@@ -0,0 +1,309 @@
+/*
+ *
+ * CHIPIT
+ *
+ * The CHIP-8 machine core. Everything needed to execute a program lives in
+ * the Machine class, so it can be driven without SFML (see --headless).
+ */
+
+#ifndef MACHINE_H
+#define MACHINE_H
+
+#include <stdint.h>
+#include <bitset>
+#include <memory>
+
+#include "decode.h"
+#include "block.h"
+#include "jit.h"
+#include "table.h"
+#include "quirks.h"
+#include "framebuffer.h"
+
+class Profiler;
+class Debugger;
+
+// Typedefs
+typedef uint8_t   u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef uint64_t u64;
+typedef int32_t  i32;
+typedef int64_t  i64;
+
+struct OpcodeNibbles {
+    u16 d : 4;
+    u16 c : 4;
+    u16 b : 4;       // second 4 bits
+    u16 a : 4;       // first 4 bits
+};
+
+struct OpcodeBytes {
+    u16 b : 8;
+    u16 a : 8;
+};
+
+struct LowerThree {
+    u16 b : 12;
+    u16 a : 4;
+};
+
+union opcodeBits {
+    OpcodeNibbles n;
+    OpcodeBytes b;
+    LowerThree t;
+    u16 opcode;
+};
+
+// Where loadFont() puts the SUPER-CHIP's big 8x10 digits (Fx30), right after
+// the 4x5 ones at 0 (Fx29)
+const u16 bigFontAddr = 0x050;
+
+// Available execution engines
+enum class Engine {
+    Switch,         // decode every instruction with executeOpcode() (reference)
+    Predecode,      // run instructions from the predecoded instruction cache
+    Block,          // run whole basic blocks of predecoded instructions at a time
+    Jit,            // translate hot blocks to native x86-64 code
+    Aot,            // run the program translated to C++ with --aot (see aot.h)
+    Table,          // dispatch every instruction through opcodeTable (see table.h)
+};
+
+/*
+ * Everything that makes up the state of a running program. It's a plain
+ * struct without pointers, so a snapshot is a single copy and can be written
+ * to a file as is (in the host's byte order). Machine adds the caches and
+ * settings on top of it.
+ */
+struct MachineState {
+    // The CHIP-8 has 4096 bytes of ram:
+    // 0x000 - 0x1FF - originally the CHIP-8 interpreter. In modern times commonly used for storing fonts.
+    // 0x200 - 0xE9F - program code
+    // 0xEA0 - 0xEFF - call stack, internal use and other variables
+    // 0xF00 - 0xFFF - display refresh
+    u8 ram[4096];
+
+    // Registers. The CHIP-8 has 16 8-bit registers, named V0 - VF.
+    // VF doubles as a flag for some instructions. VF is also carry flag.
+    // While in subtraction, it is the "not borrow" flag. In the draw instruction, VF is set upon pixel collision.
+    u8 v[16];
+
+    // The stack holds 16 return addresses. stackptr wraps around, so a
+    // program that nests too deep (or returns too often) overwrites its
+    // own return addresses rather than the rest of the machine.
+    u16 stack[16];
+    u8 stackptr;
+
+    // I - 16 bit register for memory address
+    u16 I;
+
+    // PC - program counter
+    u16 pc;
+
+    // Delay timer is intended for timing the events of games. Can be set and read.
+    u8 delaytimer;
+    // Sound effects. A beeping sound is made when value is non-zero.
+    u8 soundtimer;
+
+    // 16 input keys
+    u8 key[16];
+
+    // The display is 64x32 pixels, or 128x64 in the SUPER-CHIP's high
+    // resolution, in two bitplanes (see framebuffer.h)
+    Framebuffer display;
+
+    // The SUPER-CHIP's user flags (RPL flags on the HP 48), written and read
+    // by Fx75/Fx85. XO-CHIP has 16 of them.
+    u8 flags[16];
+
+    // Total number of instructions executed since reset()
+    u64 cycles;
+
+    // Instructions executed so far in the current frame
+    int frameCycles;
+
+    // State of the random number generator used by Cxkk
+    u32 rng;
+};
+
+class Machine : public MachineState {
+    public:
+        // Display rows changed since the frontend last picked them up, bit n
+        // for row n of the 128x64 framebuffer. Only rows whose contents
+        // actually changed are marked, except after a scroll; the frontend
+        // clears the bits it has redrawn.
+        u64 dirtyRows;
+
+        // How many instructions make up one 60 Hz frame. The timers are
+        // ticked once per frame.
+        int cyclesPerFrame;
+
+        // How instructions are executed
+        Engine engine;
+
+        // Which CHIP-8 variant the program is written for. Change it with
+        // setQuirks(), which drops the code generated for the old one.
+        Quirks quirks;
+
+        // The random number generator starts from this on reset(). The same
+        // seed, program and input always give the same run.
+        u32 seed;
+
+        // Predecoded instruction cache, one entry per even address.
+        // Entries are reset to opDecode whenever RAM at their address is written.
+        Decoded decoded[4096 / 2];
+
+        // Counts every instruction when set (see profile.h). Not owned.
+        Profiler *profiler;
+
+        // Breakpoints and watchpoints when set (see debugger.h). Not owned.
+        Debugger *debugger;
+
+        // Set when the debugger stopped the program on a breakpoint or
+        // watchpoint. The machine stays on that instruction until resumed.
+        bool stopped;
+
+        // Basic block cache, only allocated when the block engine is used
+        std::unique_ptr<BlockCache> blocks;
+
+        // Translated code, only allocated when the JIT engine is used
+        std::unique_ptr<Jit> jit;
+
+        // Addresses that are part of a cached block or translated code.
+        // Writing to one of them invalidates the blocks/code containing it.
+        std::bitset<4096> codeMap;
+
+        // Set while the aot engine can use the program linked in (aotProgram):
+        // RAM holds its code, and nothing has been written to it since
+        bool aotValid;
+
+        Machine();
+
+        void reset();
+        void loadFont();
+        int loadRom(const char *filename);
+        int loadRom(const u8 *data, int size);
+
+        // Save states. restore() only drops cached code for the parts of RAM
+        // that actually differ, so jumping between snapshots of the same
+        // program is cheap.
+        void snapshot(MachineState &s) const { s = *this; }
+        void restore(const MachineState &s);
+        bool saveState(const char *filename) const;
+        bool loadState(const char *filename);
+
+        // executeOpcode() runs the instantiation for the current quirks
+        template <class Q> int executeOpcode();
+        int executeOpcode();
+        void setQuirks(Quirks q);
+        void invalidateCode();
+        bool checkAot();
+
+        // Does the instruction at addr have to be left out of blocks and
+        // translated code, so the debugger gets to see it?
+        bool trapped(u16 addr, u16 opcode) const;
+
+        // All writes to RAM by the program must go through here, so that stale
+        // predecoded instructions, blocks and translated code are dropped.
+        void writeRam(u16 addr, u8 value)
+        {
+            addr &= 0xFFF;
+            ram[addr] = value;
+            decoded[addr >> 1].fn = opDecode;
+            if (codeMap[addr])
+                codeWritten(addr);
+        }
+        void codeWritten(u16 addr);
+
+        // Execute the instruction at PC from the predecoded instruction cache.
+        // Returns how much PC should be advanced, like executeOpcode().
+        int executeDecoded()
+        {
+            if (pc & 0xF001)
+                return executeOpcode();
+            const Decoded &d = decoded[pc >> 1];
+            return d.fn(*this, d);
+        }
+
+        // Execute the instruction at PC with a single lookup in the opcode
+        // table of the current quirks. Returns how much PC should be
+        // advanced, like executeOpcode().
+        int executeTable()
+        {
+            u16 opcode = (ram[pc & 0xFFF] << 8) | ram[(pc + 1) & 0xFFF];
+            return opcodeTables[(int)quirks].fn[opcode](*this, opcode);
+        }
+
+        // Execute all instructions of a block. Only the last one can change
+        // the flow of control, so PC is only set up for that one.
+        void runBlock(const Block &b)
+        {
+            const Decoded *op = b.ops;
+            const Decoded *last = b.ops + b.length - 1;
+            for (; op != last; op++)
+                op->fn(*this, *op);
+            pc = b.end - 2;
+            pc += last->fn(*this, *last);
+        }
+
+        // Next number from the machine's own random number generator (xorshift32)
+        u32 nextRandom()
+        {
+            rng ^= rng << 13;
+            rng ^= rng >> 17;
+            rng ^= rng << 5;
+            return rng;
+        }
+
+        // FNV-1a hash of the whole MachineState
+        u64 stateHash() const;
+
+        void tickTimers()
+        {
+            if(delaytimer > 0)
+                delaytimer--;
+            if(soundtimer > 0)
+                soundtimer--;
+        }
+
+        // Same as calling tickTimers() n times
+        void tickTimers(u64 n)
+        {
+            delaytimer = delaytimer > n ? delaytimer - n : 0;
+            soundtimer = soundtimer > n ? soundtimer - n : 0;
+        }
+
+        // Account for n executed instructions, ticking the timers once for
+        // every frame they complete
+        void endCycles(u64 n)
+        {
+            u64 c = frameCycles + n;
+            if (c >= (u64)cyclesPerFrame) {
+                tickTimers(c / cyclesPerFrame);
+                c %= cyclesPerFrame;
+            }
+            frameCycles = c;
+        }
+
+        // drawSprite() draws with the current quirks
+        template <class Q> void drawSprite(u8 vx, u8 vy, u8 h);
+        void drawSprite(u8 vx, u8 vy, u8 h);
+        void clearDisplay() { dirtyRows |= display.clear(); }
+        void setHires(bool on) { dirtyRows |= display.setHires(on); }
+        void scrollDown(unsigned n) { dirtyRows |= display.scrollDown(n); }
+        void scrollUp(unsigned n) { dirtyRows |= display.scrollUp(n); }
+        void scrollRight() { dirtyRows |= display.scrollRight(); }
+        void scrollLeft() { dirtyRows |= display.scrollLeft(); }
+        // Colour of a pixel of the 128x64 framebuffer
+        int pixel(int x, int y) const { return display.pixel(x, y); }
+
+        void step();
+        void runCycles(u64 n);
+        void runFrame();
+        void runFrames(u64 n);
+
+    private:
+        template <class Q> void run(u64 n);
+};
+
+#endif
@@ -7,421 +7,272 @@
  * TODO: Keypresses, drawing, sprites, BCD instruction.
  */
 
-#include <unistd.h>
 #include <stdint.h>
-#include <iostream>
 #include <string>
 #include <cstring>
 #include <cstdint>
+#include <chrono>
+#include <thread>
+#include <atomic>
 
 //#include <fmt/format.h>
 #include <SFML/Window.hpp>
 #include <SFML/Graphics.hpp>
 
-// Typedefs
-typedef uint8_t   u8;
-typedef uint16_t u16;
-typedef uint32_t u32;
-typedef uint64_t u64;
-typedef int32_t  i32;
-typedef int64_t  i64;
+#include "machine.h"
+#include "batch.h"
+#include "lockstep.h"
+#include "rewind.h"
+#include "input.h"
+#include "display.h"
+#include "disasm.h"
+#include "profile.h"
+#include "debugger.h"
+#include "aot.h"
+#include "video.h"
+#include "triple.h"
 
 // SFML
 sf::RenderWindow window;
-sf::RenderTexture tex;
-sf::Clock clck;
-sf::Font sfmlFont;
-sf::Text t;
-
-const int pixelWidth = 16;
-const int pixelHeight = 16;
-const int c8Width = 64 * pixelWidth;
-const int c8Height = 32 * pixelHeight;
-const int screenWidth = c8Width + 500;
-const int screenHeight = c8Height + 500;
-// CHIP-8 output offset
-const int c8X = (screenWidth / 2) - (c8Width / 2) + 20, c8Y = 20;
-// Registers output offset
-const int regX = 32;
-const int regY = c8Height + 32;
 
 // Some flags
 bool verbose = false;
-bool dirtyDisplay = true;
-std::map<uint16_t, std::string> disasm;
 
+// The emulated machine
+Machine chip;
 
-struct OpcodeNibbles {
-    u16 d : 4;
-    u16 c : 4;
-    u16 b : 4;       // second 4 bits
-    u16 a : 4;       // first 4 bits
-};
-
-struct OpcodeBytes {
-    u16 b : 8;
-    u16 a : 8;
-};
-
-struct LowerThree {
-    u16 b : 12;
-    u16 a : 4;
-};
-
-union opcodeBits {
-    OpcodeNibbles n;
-    OpcodeBytes b;
-    LowerThree t;
-    u16 opcode;
-};
-
-// The CHIP-8 has 4096 bytes of ram:
-// 0x000 - 0x1FF - originally the CHIP-8 interpreter. In modern times commonly used for storing fonts.
-// 0x200 - 0xE9F - program code
-// 0xEA0 - 0xEFF - call stack, internal use and other variables
-// 0xF00 - 0xFFF - display refresh
-u8 ram[4096] = {0};
-
-// Registers. The CHIP-8 has 16 8-bit registers, named V0 - VF.
-// VF doubles as a flag for some instructions. VF is also carry flag.
-// While in subtraction, it is the "not borrow" flag. In the draw instruction, VF is set upon pixel collision.
-u8 v[16];
-u8 &V0 = v[0x0];
-u8 &V1 = v[0x1];
-u8 &V2 = v[0x2];
-u8 &V3 = v[0x3];
-u8 &V4 = v[0x4];
-u8 &V5 = v[0x5];
-u8 &V6 = v[0x6];
-u8 &V7 = v[0x7];
-u8 &V8 = v[0x8];
-u8 &V9 = v[0x9];
-u8 &VA = v[0xa];
-u8 &VB = v[0xb];
-u8 &VC = v[0xc];
-u8 &VD = v[0xd];
-u8 &VE = v[0xe];
-u8 &VF = v[0xf];
-
-// An opcode is 2 bytes / 16 bits
-//u16 opcode;
-
-// The stack is 48 bytes
-u16 stack[24];
-u8 stackptr = -1;
-
-// I - 16 bit register for memory address
-u16 I;
-
-// PC - program counter
-u16 pc;
-
-// Delay timer is intended for timing the events of games. Can be set and read.
-u8 delaytimer = 0;
-// Sound effects. A beeping sound is made when value is non-zero.
-u8 soundtimer = 0;
-
-// 16 input keys
-u8 key[16];
-
-typedef struct {
-    int x, y;
-    bool pixel;
-} pixelData;
-
-// The display is 64x32 pixels. Color is monochrome.
-//u8 pixels[64*32];
-std::array<pixelData, 64*32> pixels;
-// vector is maaaybe slower than array, but if averaged probably very similar.
-// Note: compile with optimization! in debug mode vector is noticably slower than array.
-// std::vector<pixelData> pixels;
-
-// The font sprites
-u8 font[16][5] = {
-    { 0xF0, 0x90, 0x90, 0x90, 0xF0 },  // 0
-    { 0x20, 0x60, 0x20, 0x20, 0x70 },  // 1
-    { 0xF0, 0x10, 0xF0, 0x80, 0xF0 },  // etc..
-    { 0xF0, 0x10, 0xF0, 0x10, 0xF0 },
-    { 0x90, 0x90, 0xF0, 0x10, 0x10 },
-    { 0xF0, 0x80, 0xF0, 0x10, 0xF0 },
-    { 0xF0, 0x80, 0xF0, 0x90, 0xF0 },
-    { 0xF0, 0x10, 0x20, 0x40, 0x40 },
-    { 0xF0, 0x90, 0xF0, 0x90, 0xF0 },
-    { 0xF0, 0x90, 0xF0, 0x10, 0xF0 },
-    { 0xF0, 0x90, 0xF0, 0x90, 0x90 },
-    { 0xE0, 0x90, 0xE0, 0x90, 0xE0 },
-    { 0xF0, 0x80, 0x80, 0x80, 0xF0 },
-    { 0xE0, 0x90, 0x90, 0x90, 0xE0 },
-    { 0xF0, 0x80, 0xF0, 0x80, 0xF0 },
-    { 0xF0, 0x80, 0xF0, 0x80, 0x80 }
-};
-
-// Forward declarations
-void drawSprite(u8 vx, u8 vy, u8 h);
-int executeOpcode();
-std::map<uint16_t, std::string> disassemble(uint16_t start, uint16_t end);
-
-//void dumpProgram(int start, int length)
-//{
-//    u16 opcode = 0;
-//    for(int i = 0; i < length; i+=2) {
-//        opcode = (ram[start + i] << 8) | ram[start + i + 1];
-//        fmt::print("{0:0>4x} - ", start + i);
-//        decodeOpcode(opcode);
-//    }
-//}
-
-// simple way to measure execution time - could be better...
-std::string measureTask;
-sf::Time start;
-sf::Time end;
-sf::Time elapsed;
-void measureStart(std::string task)
-{
-    measureTask = task;
-    start = clck.getElapsedTime();
-}
+// Save state file (F5 / F9) and the rewind history (Backspace)
+std::string statePath;
+std::unique_ptr<Rewind> history;
 
-void measureEnd()
-{
-    end = clck.getElapsedTime();
-    sf::Time elapsed = end - start;
-    std::cout << measureTask << " took " << elapsed.asMicroseconds() << " microseconds" << std::endl;
-}
+// Input recording (--record-input), saved when the window is closed
+std::string recordPath;
+std::unique_ptr<InputLog> recording;
 
-void initPixelData()
-{
-    for (int y = 0; y < 32; y++) {
-        for (int x = 0; x < 64; x++) {
-            pixels[x + (y*64)].x = x * pixelWidth;
-            pixels[x + (y*64)].y = y * pixelHeight;
-            pixels[x + (y*64)].pixel = false;
-        }
-    }
-}
+// Frames run per 60 Hz frame while fast-forwarding (Tab, --turbo), 0 for as
+// many as fit
+int turboSpeed = 0;
 
+// Breakpoints and watchpoints (--break, --watch, F2), only created once
+// there's one
+std::unique_ptr<Debugger> debugger;
 
+// Profiler (--profile), the call graph is written to profilePath at the end
+std::string profilePath;
+std::unique_ptr<Profiler> profiler;
 
-void initEmulator()
-{
-    // TODO: set everything to zero / other initial value
-    pc = 0x200;
-    //opcode = 0;
-    I = 0;
-    stackptr = 0;
-}
+// Video recording (--record), every frame that's run is written to videoPath
+std::string videoPath;
+std::unique_ptr<VideoRecorder> video;
 
-void runCPU()
+void initSFML()
 {
-    //if (verbose) fmt::print("{0:0>4x} - ", pc);
-
-    pc += executeOpcode();
-
-    // these should decrement at 60Hz (60 times per second) TODO: implement correct timing!
-    if(delaytimer > 0)
-        delaytimer--;
-    if(soundtimer > 0)
-        soundtimer--;
-}
+    //sf::VideoMode desktop = sf::VideoMode::getDesktopMode();
 
-void loadFont()
-{
-    for (int i = 0; i < 16; i++) {
-        std::memcpy(&ram[i*5], font[i], 5*sizeof(u8));
-    }
-}
+    window.create(sf::VideoMode(screenWidth, screenHeight), "chipit");
+    sf::Vector2i windowPosition;
+    windowPosition.x = 1700; //(desktop.width / 4) - (screenWidth / 2);
+    windowPosition.y = 50; //(desktop.height / 2) - (screenHeight / 2);
+    window.setPosition(windowPosition);
+    // Frames are paced by the emulation thread, presenting only has to
+    // keep up with it
+    window.setVerticalSyncEnabled(true);
+    window.clear(sf::Color::Black);
 
-// fmt::print("D{0:X}{1:X}{2:X}: Draw sprite at V{0:X},V{1:X} with height {2:d} pixels.", bits.n.b, bits.n.c, bits.n.d);
-// Dxyn - DRW Vx, Vy, nibble
-// Display n-byte sprite starting at memory location I at (Vx, Vy), set VF = collision.
-// The interpreter reads n bytes from memory, starting at the address stored in I. These bytes are then displayed as sprites on
-// screen at coordinates (Vx, Vy). Sprites are XORed onto the existing screen. If this causes any pixels to be erased,
-// VF is set to 1, otherwise it is set to 0. If the sprite is positioned so part of it is outside the coordinates of the display,
-// it wraps around to the opposite side of the screen. 
-//
-// parts of drawSprite code borrowed from https://github.com/JamesGriffin/CHIP-8-Emulator/blob/master/src/chip8.cpp
-void drawSprite(u8 vx, u8 vy, u8 h)
-{
-    u8 &x = v[vx];
-    u8 &y = v[vy];
-
-    // TODO: Deal with coordinates out of bounds!
-    VF = 0;
-    for (int yl = 0; yl < h; yl++) {
-        u8 &pixel = ram[I + yl];
-        for (int xl = 0; xl < 8; xl++) {
-            if ((pixel & (0x80 >> xl))) {
-                int pos = (x+xl) + ((y+yl)*64);
-                if (pixels[pos].pixel) {
-                    VF = 1;
-                }
-                pixels[pos].pixel ^= 1;
-            }
-        }
+    if (!initDisplay()) {
+        printf("ERROR: couldn't create the screen texture or load the font file!\n");
+        exit(1);
     }
 }
 
 /*
- * Render a pixel from Chip-8 memory to the actual screen
+ * The emulator runs on a thread of its own, emulationLoop(), so presenting
+ * the window (with vsync) and running the program never hold each other up.
+ * At the end of every 60 Hz frame the emulation thread publishes the state of
+ * the machine through a triple buffer, and mainLoop() presents the latest one
+ * whenever the window is ready for it. Keys and commands go the other way,
+ * through atomics; everything else belongs to the emulation thread while it
+ * runs.
  */
-sf::RectangleShape rect;
-void renderPixel(int x, int y)
+struct Frame {
+    MachineState state;
+    u64 dirtyRows;       // display rows changed since the last frame picked up
+};
+TripleBuffer<Frame> frames;
+
+std::atomic<u16> keysDown(0);            // bit n for key n
+std::atomic<bool> running(false);
+std::atomic<bool> rewinding(false);
+std::atomic<bool> fastForward(false);
+std::atomic<int> stepsRequested(0);
+std::atomic<bool> saveRequested(false);
+std::atomic<bool> loadRequested(false);
+std::atomic<bool> breakToggled(false);
+std::atomic<bool> quit(false);
+
+void setKey(int k, bool down)
 {
-    rect.setPosition(x * pixelWidth, y * pixelHeight);
-    tex.draw(rect);
+    if (down)
+        keysDown.fetch_or(1 << k);
+    else
+        keysDown.fetch_and(~(1 << k));
 }
 
-void drawString(int x, int y, std::string s)
+// Every pass through the loop is one 60 Hz frame: handle commands, run a
+// frame's worth of instructions (chip.cyclesPerFrame), publish the result and
+// sleep for whatever is left of the frame. While fast-forwarding, a pass runs
+// turboSpeed frames instead, and only the last one is published, so the
+// window still gets one frame per refresh.
+void emulationLoop()
 {
-    t.setString(s);
-    t.setPosition(x, y);
-    tex.draw(t);
-}
+    typedef std::chrono::steady_clock clock;
+    const clock::duration frameTime = std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(1.0 / 60));
+
+    clock::time_point nextFrame = clock::now();
+    u64 frame = 0;
+    u64 unseenRows = 0;
+    MachineState state;
+
+    while (!quit) {
+        if (saveRequested.exchange(false)) {
+            if (chip.saveState(statePath.c_str()))
+                printf("[state saved to %s]\n", statePath.c_str());
+            else
+                printf("ERROR: couldn't save state to %s!\n", statePath.c_str());
+        }
 
-void drawDisassembly(int x,  int y, int lines)
-{
-    auto it = disasm.find(pc);
-    auto next = disassemble(pc, pc);
-    int liney = (lines >> 1) * 10 + y;
-
-    // Draw "live" (it's not really live yet) disassembly of next instruction
-    t.setFillColor(sf::Color::Cyan);
-    drawString(x, liney, next[pc]);
-    t.setFillColor(sf::Color::White);
-
-    // Draw the rest
-    if (it != disasm.end()) {
-        while (liney < (lines * 10) + y) {
-            liney += 16;
-            if (++it != disasm.end()) {
-                drawString(x, liney, (*it).second);
+        // A recording is only a list of keys per frame, so while recording
+        // there's no single stepping, rewinding or loading states
+        if (loadRequested.exchange(false) && !recording) {
+            if (chip.loadState(statePath.c_str())) {
+                // The history leads up to another state now
+                if (history)
+                    history->clear();
+                printf("[state loaded from %s]\n", statePath.c_str());
+            } else {
+                printf("ERROR: couldn't load state from %s!\n", statePath.c_str());
             }
         }
-    }
-
-    it = disasm.find(pc);
-    liney = (lines >> 1) * 10 + y;
-    if (it != disasm.end()) {
-        while (liney > y) {
-            liney -= 16;
-            if (--it != disasm.end()) {
-                drawString(x, liney, (*it).second);
+        // Breakpoints stop the program in the middle of a frame, which a
+        // recording can't replay, and the profiler runs without the
+        // predecoded cache they live in
+        if (breakToggled.exchange(false) && !recording && !profiler) {
+            u16 pc = chip.pc & 0xFFF;
+            if (!debugger)
+                debugger.reset(new Debugger(chip));
+            if (pc & 1) {
+                printf("ERROR: no breakpoints on odd addresses!\n");
+            } else if (debugger->hasBreakpoint(pc)) {
+                debugger->removeBreakpoints(pc);
+                printf("[breakpoint at 0x%03X removed]\n", pc);
+            } else {
+                debugger->addBreakpoint({ pc, Debugger::Cond::Always, 0, 0 });
+                printf("[breakpoint set at 0x%03X]\n", pc);
             }
         }
-    }
-}
-
-// this is still slow.
-// migrate to SDL? not use rect?
-void updateDisplay()
-{
-    const int fontsize = 20;
-    char out[100];
-
-    tex.clear(sf::Color::Black);
-
-    // Draw debug / disasm info
-    t.setFont(sfmlFont);
-    t.setCharacterSize(fontsize);
-    t.setFillColor(sf::Color::White);
-
-    // - Draw registers
-    for (int reg = 0; reg < 16; reg++) {
-        sprintf(out, "V%01X: %02X", reg, v[reg]);
-        drawString(regX, regY + (reg * (fontsize + 4)), std::string(out));
-    }
-
-    // PC
-    sprintf(out, "PC: %04X", pc);
-    drawString(regX + (6 * fontsize) + 12, regY, std::string(out));
-
-    // I
-    sprintf(out, " I: %04X", I);
-    drawString(regX + (6 * fontsize) + 12, regY + (fontsize + 2), std::string(out));
-
-    // SP
-    sprintf(out, "SP: %04X", stackptr);
-    drawString(regX + (6 * fontsize) + 12, regY + 2 * (fontsize + 2), std::string(out));
 
-    // Disassembly
-    drawDisassembly(regX + (6 * fontsize) + 150, regY, 16);
-
-    // TODO: timers
-    // TODO: keys
-    // TODO: RAM
-    
-    // Draw Chip-8 output
-    for (auto it : pixels) {
-        if (it.pixel) {
-            rect.setFillColor(sf::Color::White);
-            rect.setPosition(c8X + it.x, c8Y + it.y);
-            tex.draw(rect);
-        } else {
-            rect.setFillColor(sf::Color::Black);
-            rect.setPosition(c8X + it.x, c8Y + it.y);
-            tex.draw(rect);
+        int steps = stepsRequested.exchange(0);
+        bool rewind = rewinding && history && !recording;
+
+        // Running or stepping goes on from where the debugger stopped
+        if (debugger && (steps || (running && !rewind)))
+            debugger->resume();
+
+        // Go back one frame per frame while rewinding. Restored states come
+        // with the keys they were saved with, the ones down now replace them.
+        if (rewind && history->pop(state))
+            chip.restore(state);
+
+        u16 keys = keysDown;
+        for (int k = 0; k < 16; k++)
+            chip.key[k] = (keys >> k) & 1;
+
+        bool wasStopped = chip.stopped;
+        for (; steps > 0 && !recording && !chip.stopped; steps--)
+            chip.step();
+
+        // Record every frame that is run. Without a turbo speed, run frames
+        // until this one is over, looking at the clock every 16 frames.
+        if (!rewind && running) {
+            int n = fastForward ? turboSpeed : 1;
+            clock::time_point deadline = nextFrame + frameTime;
+            for (int i = 0; n ? i < n : (i & 15) || clock::now() < deadline; i++) {
+                if (recording)
+                    recording->record(frame, chip.key);
+                chip.runFrame();
+                frame++;
+                if (video)
+                    video->push(chip.display, false);
+                if (history) {
+                    chip.snapshot(state);
+                    history->push(state);
+                }
+                if (chip.stopped)
+                    break;
+            }
         }
-    }
-
-
-    dirtyDisplay = false;
-}
 
-void initSFML()
-{
-    //sf::VideoMode desktop = sf::VideoMode::getDesktopMode();
-
-    window.create(sf::VideoMode(screenWidth, screenHeight), "chipit");
-    sf::Vector2i windowPosition;
-    windowPosition.x = 1700; //(desktop.width / 4) - (screenWidth / 2);
-    windowPosition.y = 50; //(desktop.height / 2) - (screenHeight / 2);
-    window.setPosition(windowPosition);
-    window.setVerticalSyncEnabled(true);
-    window.clear(sf::Color::Black);
-
-    tex.create(screenWidth, screenHeight);
+        if (chip.stopped && !wasStopped) {
+            printf("[%s]\n", debugger->reason().c_str());
+            running = false;
+        }
 
-    rect.setSize(sf::Vector2f(pixelWidth, pixelHeight));
-    rect.setFillColor(sf::Color::White);
+        // Every frame carries the rows changed since the last frame that was
+        // picked up. Only if the one before it was, that's just its own.
+        u64 rows = chip.dirtyRows;
+        chip.dirtyRows = 0;
+        Frame &f = frames.writeBuffer();
+        chip.snapshot(f.state);
+        f.dirtyRows = rows | unseenRows;
+        unseenRows = frames.publish() ? f.dirtyRows : rows;
+
+        // Sleep until the next frame is due. If we're more than a frame
+        // behind (slow host...) don't try to catch up.
+        nextFrame += frameTime;
+        clock::time_point now = clock::now();
+        if (nextFrame > now)
+            std::this_thread::sleep_until(nextFrame);
+        else if (now - nextFrame > frameTime)
+            nextFrame = now;
+    }
 
-    if(!sfmlFont.loadFromFile("Courier Prime Code.ttf")) {
-        printf("ERROR: couldn't load font file!\n");
-        exit(1);
+    if (recording) {
+        recording->frames = frame;
+        recording->finalHash = chip.stateHash();
+        if (recording->save(recordPath.c_str()))
+            printf("[%llu frames of input saved to %s]\n", (unsigned long long)frame, recordPath.c_str());
+        else
+            printf("ERROR: couldn't save input to %s!\n", recordPath.c_str());
     }
 }
 
 // The slowness was caused by calling window.display all the time in the main loop!!!
 // Changed it to only be called when we update the display - now the emulator is really fast!
 //
+// The window's side: present the latest frame from the emulation thread if
+// anything on screen changed, and pass on keys and commands.
+//
 // TODO: flag to set if we are to do debug output (disasm / cpu monitor / etc)
 void mainLoop()
 {
+    std::thread emulator(emulationLoop);
     bool done = false;
-    bool run = false, runOnce = false;;
 
     while (window.isOpen() && !done) {
 
-        if (runOnce) {
-            runCPU();
-            runOnce = false;
-            dirtyDisplay = true;
-        }
-
-        if (run) {
-            runCPU();
-            dirtyDisplay = true;
-        }
-
-        if (dirtyDisplay) {
-            updateDisplay();
-            tex.display();
-            sf::Sprite spr(tex.getTexture());
-            spr.move(0, 0);
-            window.draw(spr);
-            window.display();
+        // Only present when something on screen actually changed. display()
+        // waits for vsync, which only holds up this thread.
+        bool presented = false;
+        if (frames.fetch()) {
+            const Frame &f = frames.readBuffer();
+            if (updateDisplay(f.state, f.dirtyRows)) {
+                window.clear(sf::Color::Black);
+                drawDisplay(window);
+                window.display();
+                presented = true;
+            }
         }
 
-
         sf::Event event;
 
         while (window.pollEvent(event)) {
@@ -435,55 +286,58 @@ void mainLoop()
             if (event.type == sf::Event::KeyReleased) {
                 switch (event.key.code) {
                     case sf::Keyboard::M:
-                        run = false;
+                        running = false;
+                        break;
+                    case sf::Keyboard::BackSpace:
+                        rewinding = false;
                         break;
                     case sf::Keyboard::Num1:
-                        key[0x1] = 0;
+                        setKey(0x1, false);
                         break;
                     case sf::Keyboard::Num2:
-                        key[0x2] = 0;
+                        setKey(0x2, false);
                         break;
                     case sf::Keyboard::Num3:
-                        key[0x3] = 0;
+                        setKey(0x3, false);
                         break;
                     case sf::Keyboard::Num4:
-                        key[0xC] = 0;
+                        setKey(0xC, false);
                         break;
                     case sf::Keyboard::Q:
-                        key[0x4] = 0;
+                        setKey(0x4, false);
                         break;
                     case sf::Keyboard::W:
-                        key[0x5] = 0;
+                        setKey(0x5, false);
                         break;
                     case sf::Keyboard::E:
-                        key[0x6] = 0;
+                        setKey(0x6, false);
                         break;
                     case sf::Keyboard::R:
-                        key[0xD] = 0;
+                        setKey(0xD, false);
                         break;
                     case sf::Keyboard::A:
-                        key[0x7] = 0;
+                        setKey(0x7, false);
                         break;
                     case sf::Keyboard::S:
-                        key[0x8] = 0;
+                        setKey(0x8, false);
                         break;
                     case sf::Keyboard::D:
-                        key[0x9] = 0;
+                        setKey(0x9, false);
                         break;
                     case sf::Keyboard::F:
-                        key[0xE] = 0;
+                        setKey(0xE, false);
                         break;
                     case sf::Keyboard::Z:
-                        key[0xA] = 0;
+                        setKey(0xA, false);
                         break;
                     case sf::Keyboard::X:
-                        key[0x0] = 0;
+                        setKey(0x0, false);
                         break;
                     case sf::Keyboard::C:
-                        key[0xB] = 0;
+                        setKey(0xB, false);
                         break;
                     case sf::Keyboard::V:
-                        key[0xF] = 0;
+                        setKey(0xF, false);
                         break;
 
                     default:
@@ -494,61 +348,77 @@ void mainLoop()
             if (event.type == sf::Event::KeyPressed) {
                 switch (event.key.code) {
                     case sf::Keyboard::Space:
-                        run = !run;
+                        running = !running;
                         break;
                     case sf::Keyboard::M:
-                        run = true;
+                        running = true;
                         break;
                     case sf::Keyboard::Enter:
-                        runOnce = true;
+                        stepsRequested++;
+                        break;
+                    case sf::Keyboard::BackSpace:
+                        rewinding = true;
+                        break;
+                    case sf::Keyboard::Tab:
+                        fastForward = !fastForward;
+                        printf("[fast-forward %s]\n", fastForward ? "on" : "off");
+                        break;
+                    case sf::Keyboard::F5:
+                        saveRequested = true;
+                        break;
+                    case sf::Keyboard::F9:
+                        loadRequested = true;
+                        break;
+                    case sf::Keyboard::F2:
+                        breakToggled = true;
                         break;
                     case sf::Keyboard::Num1:
-                        key[0x1] = 1;
+                        setKey(0x1, true);
                         break;
                     case sf::Keyboard::Num2:
-                        key[0x2] = 1;
+                        setKey(0x2, true);
                         break;
                     case sf::Keyboard::Num3:
-                        key[0x3] = 1;
+                        setKey(0x3, true);
                         break;
                     case sf::Keyboard::Num4:
-                        key[0xC] = 1;
+                        setKey(0xC, true);
                         break;
                     case sf::Keyboard::Q:
-                        key[0x4] = 1;
+                        setKey(0x4, true);
                         break;
                     case sf::Keyboard::W:
-                        key[0x5] = 1;
+                        setKey(0x5, true);
                         break;
                     case sf::Keyboard::E:
-                        key[0x6] = 1;
+                        setKey(0x6, true);
                         break;
                     case sf::Keyboard::R:
-                        key[0xD] = 1;
+                        setKey(0xD, true);
                         break;
                     case sf::Keyboard::A:
-                        key[0x7] = 1;
+                        setKey(0x7, true);
                         break;
                     case sf::Keyboard::S:
-                        key[0x8] = 1;
+                        setKey(0x8, true);
                         break;
                     case sf::Keyboard::D:
-                        key[0x9] = 1;
+                        setKey(0x9, true);
                         break;
                     case sf::Keyboard::F:
-                        key[0xE] = 1;
+                        setKey(0xE, true);
                         break;
                     case sf::Keyboard::Z:
-                        key[0xA] = 1;
+                        setKey(0xA, true);
                         break;
                     case sf::Keyboard::X:
-                        key[0x0] = 1;
+                        setKey(0x0, true);
                         break;
                     case sf::Keyboard::C:
-                        key[0xB] = 1;
+                        setKey(0xB, true);
                         break;
                     case sf::Keyboard::V:
-                        key[0xF] = 1;
+                        setKey(0xF, true);
                         break;
 
                     default:
@@ -557,415 +427,488 @@ void mainLoop()
             }
         }
 
-        usleep(1200);
+        // Nothing new to show, wait a little for the emulation thread
+        if (!presented)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
     }
+
+    quit = true;
+    emulator.join();
+
     //window.clear();
 
     window.close();
 }
 
 
-int executeOpcode()
+// Run the machine without SFML, as fast as the host allows, and report
+// throughput. While recording video that's still faster than real time, but
+// the program waits for the writer rather than lose frames.
+void runHeadless(u64 cycles, u64 frames)
 {
-    //uint16_t opcode = (ram[pc] << 8) | ram[pc+1];
-    opcodeBits bits;
-    bits.opcode = (ram[pc] << 8) | ram[pc+1];
-    //const uint16_t &opcode = bits.opcode;
-
-    if(bits.b.a == 0 && bits.b.b == 0) {
-        //if (verbose) fmt::print("{0:0>2X}{1:0>2X}\n", BA(opcode), BB(opcode));
-        return 2;
+    auto begin = std::chrono::steady_clock::now();
+
+    if (video) {
+        for (u64 f = 0; f < frames; f++) {
+            chip.runFrame();
+            video->push(chip.display, true);
+        }
+    } else if (cycles) {
+        chip.runCycles(cycles);
+    } else {
+        chip.runFrames(frames);
     }
 
-    switch (bits.n.a) {                      // check the first nibble (highest 4 bits)
-        case 0:
-            if(bits.n.b == 0) {
-                if(bits.b.b == 0xE0) {       // Clear the screen
-                    //if (verbose) fmt::print("00E0: Clear the screen");
-                    for (auto it = pixels.begin(); it != pixels.end(); it++)
-                        it->pixel = false;
-                    //window.clear(sf::Color::Black);
-                    dirtyDisplay = true;
-                }
-                if(bits.b.b == 0xEE) {       // Return from subroutine
-                    //if (verbose) fmt::print("00EE: Return from subroutine");
-                    stackptr--;
-                    pc = stack[stackptr];
-                }
-            } else {
-                //fmt::print("0{0:0>3X}: Call RCA 1802 program at address {0:0>3X} NOT IMPLEMENTED\n", L3(opcode));
-            }
-            break;
-        case 1:
-            //if (verbose) fmt::print("1{0:X}: Jump to address {0:#x}", L3(opcode));
-            pc = bits.t.b;
-            //if (verbose) fmt::print("\n");
-            return 0;
-            break;
-        case 2:
-            //if (verbose) fmt::print("2{0:0>3X}: Call subroutine at address {0:0>3x}", L3(opcode));
-            // Push current PC to the stack
-            stack[stackptr] = pc;
-            stackptr++;
-            // Jump to subroutine
-            pc = bits.t.b;
-            //if (verbose) fmt::print("\n");
-            return 0;
-            break;
-        case 3:
-            //if (verbose) fmt::print("3{0:X}{1:0>2X}: Skip next instruction if V{0:X} == {1:X}", NB(opcode), BB(opcode));
-            if (v[bits.n.b] == bits.b.b)
-                pc += 2;
-            break;
-        case 4:
-            //if (verbose) fmt::print("4{0:X}{1:0>2X}: Skip next instruction if V{0:X} != {1:X}", NB(opcode), BB(opcode));
-            if (v[bits.n.b] != bits.b.b)
-                pc += 2;
-            break;
-        case 5:
-            //if (verbose) fmt::print("5{0:X}{1:X}0: Skip next instruction if V{0:X} == V{1:X}", NB(opcode), NC(opcode));
-            if (v[bits.n.b] == v[bits.n.c])
-                pc += 2;
-            break;
-        case 6:
-            //if (verbose) fmt::print("6{0:X}{1:0>2X}: V{0:X} = {1:X}", NB(opcode), BB(opcode));
-            v[bits.n.b] = bits.b.b;
-            break;
-        case 7:
-            //if (verbose) fmt::print("7{0:X}{1:0>2X}: V{0:X} += {1:X}", NB(opcode), BB(opcode));
-            v[bits.n.b] += bits.b.b;
-            break;
-        case 8:
-            switch(bits.n.d) {
-                case 0x0:
-                    //if (verbose) fmt::print("8{0:X}{1:X}0: V{0:X} = V{1:X}", NB(opcode), NC(opcode));
-                    v[bits.n.b] = v[bits.n.c];
-                    break; 
-                case 0x1:
-                    //if (verbose) fmt::print("8{0:X}{1:X}1: V{0:X} = V{0:X} OR V{1:X} (bitwise OR)", NB(opcode), NC(opcode));
-                    v[bits.n.b] |= v[bits.n.c];
-                    break; 
-                case 0x2:
-                    //if (verbose) fmt::print("8{0:X}{1:X}2: V{0:X} = V{0:X} AND V{1:X} (bitwise AND)", NB(opcode), NC(opcode));
-                    v[bits.n.b] &= v[bits.n.c];
-                    break; 
-                case 0x3:
-                    //if (verbose) fmt::print("8{0:X}{1:X}3: V{0:X} = V{0:X} XOR V{1:X} (bitwise XOR)", NB(opcode), NC(opcode));
-                    v[bits.n.b] ^= v[bits.n.c];
-                    break; 
-                case 0x4:
-                    //if (verbose) fmt::print("8{0:X}{1:X}4: V{0:X} += V{1:X} - VF set to 1 when there's a carry.", NB(opcode), NC(opcode));
-                    if ((v[bits.n.b] + v[bits.n.c]) > 0xFF)
-                        VF = 1;
-                    else
-                        VF = 0;
-                    v[bits.n.b] += v[bits.n.c];
-                    break; 
-                case 0x5:
-                    //if (verbose) fmt::print("8{0:X}{1:X}5: V{0:X} -= V{1:X} - VF set to 0 when there's a borrow, 1 if not.", NB(opcode), NC(opcode));
-                    if (v[bits.n.b] > v[bits.n.c])
-                        VF = 1;
-                    else
-                        VF = 0;
-                    v[bits.n.b] -= v[bits.n.c];
-                    break; 
-                case 0x6:
-                    //if (verbose) fmt::print("8{0:X}{1:X}6: V{0:X} >>= 1. VF is set to the value of the LSB of V{0:X} before the shift.", NB(opcode), NC(opcode));
-                    if (v[bits.n.b] & 1)
-                        VF = 1;
-                    else
-                        VF = 0;
-                    v[bits.n.b] >>= 1;
-                    break; 
-                case 0x7:
-                    //if (verbose) fmt::print("8{0:X}{1:X}7: V{0:X} = V{1:X} - V{0:X}. VF is set to 0 when there's a borrow.", NB(opcode), NC(opcode));
-                    if (v[bits.n.b] > v[bits.n.c])
-                        VF = 0;
-                    else
-                        VF = 1;
-                    v[bits.n.b] = v[bits.n.c] - v[bits.n.b];
-                    break; 
-                case 0xE:
-                    //if (verbose) fmt::print("8{0:X}{1:X}6: V{0:X} <<= 1. VF is set to the value of the MSB of V{0:X} before the shift.", NB(opcode), NC(opcode));
-                    VF = (v[bits.n.b] >> 7);
-                    v[bits.n.b] <<= 1;
-                    break; 
-                default:
-                    break;
-            }
-            break;
-        case 9:
-            //if (verbose) fmt::print("9{0:X}{1:X}0: Skip next instruction if V{0:X} != V{1:X}", NB(opcode), NC(opcode));
-            if (v[bits.n.b] != v[bits.b.b])
-                pc += 2;
-            break;
-        case 0xA:
-            //if (verbose) fmt::print("A{0:0>3X}: Set I to the address {0:0>3X}", L3(opcode));
-            I = bits.t.b;
-            break;
-        case 0xB:
-            //if (verbose) fmt::print("B{0:0>3X}: PC = V0 + {0:0>3X} (jump to address {0:0>3X} + V0)\n", L3(opcode));
-            pc = V0 + bits.t.b;
-            return 0;
-            break;
-        case 0xC:
-            //if (verbose) fmt::print("C{0:X}{1:0>2X}: V{0:X} = rand() & {1:X}", NB(opcode), L3(opcode));
-            v[bits.n.b] = rand() % (bits.b.b + 1);
-            break;
-        case 0xD: // TODO
-            //if (verbose) fmt::print("D{0:X}{1:X}{2:X}: Draw sprite at V{0:X},V{1:X} with height {2:d} pixels.", NB(opcode), NC(opcode), ND(opcode));
-            drawSprite(bits.n.b, bits.n.c, bits.n.d);
-            dirtyDisplay = true;
-            break;
-        case 0xE:
-            if(bits.b.b == 0x9E) {
-                //if (verbose) fmt::print("E{0:X}9E: Skip next instruction if key stored in V{0:X} ({1:X}) is pressed.", NB(opcode), v[bits.n.b]);
-                if(key[v[bits.n.b]])
-                    pc += 2;
-            }
-            if(bits.b.b == 0xA1) {
-                //if (verbose) fmt::print("E{0:X}A1: Skip next instruction if key stored in V{0:X} is not pressed.", NB(opcode));
-                if(!key[v[bits.n.b]])
-                    pc += 2;
-            }
-            break;
-        case 0xF:
-            switch (bits.b.b) {
-                case 0x07:
-                    //if (verbose) fmt::print("F{0:X}07: Set V{0:X} to the value of the delay timer.", NB(opcode));
-                    v[bits.n.b] = delaytimer;
-                    break;
-                case 0x0A: {
-                               //if (verbose) fmt::print("F{0:X}0A: Wait for keypress and store it in V{0:X}. Blocking operation - all instruction halted until next key event.\n", NB(opcode));
-                               bool keyPressed = false;
-                               for (int i = 0; i < 16; i++) {
-                                   if (key[i]) {
-                                       V0 = i;
-                                       keyPressed = true;
-                                       //if (verbose) fmt::print("KEY PRESSED: {0:X} V0 is now: {1:X}\n", i, V0);
-                                       return 2;
-                                   }
-                               }
-                               if(!keyPressed)
-                                   return 0;
-                           }
-                    break;
-                case 0x15:
-                    //if (verbose) fmt::print("F{0:X}15: Set delay timer to V{0:X}", NB(opcode));
-                    delaytimer = v[bits.n.b];
-                    break;
-                case 0x18:
-                    //if (verbose) fmt::print("F{0:X}18: Set sound timer to V{0:X}", NB(opcode));
-                    soundtimer = v[bits.n.b];
-                    break;
-                case 0x1E:
-                    //if (verbose) fmt::print("F{0:X}1E: I += V{0:X}", NB(opcode));
-                    I += v[bits.n.b];
-                    break;
-                case 0x29:
-                    //if (verbose) fmt::print("F{0:X}29: Set I to the location of the sprite for the character in V{0:X}", NB(opcode));
-                    I = v[bits.n.b] * 5;
-                    break;
-                case 0x33:
-                    //if (verbose) fmt::print("F{0:X}33: BCD(V{0:X}) - store binary coded decimal representation of V{0:X} at address I ({1:X})", NB(opcode), I);
-                    ram[I+0] =  v[bits.n.b] / 100;
-                    ram[I+1] = (v[bits.n.b] /  10) % 10;
-                    ram[I+2] = (v[bits.n.b] % 100) % 10;
-                    break;
-                case 0x55:
-                    //if (verbose) fmt::print("F{0:X}55: Store V0-V{0:X} in memory starting at address in I. I += 1 for each value written.", NB(opcode));
-                    for(int r = 0; r <= bits.n.b; r++) {
-                        ram[I] = v[r];
-                        I++;
-                    }
-                    break;
-                case 0x65:
-                    //if (verbose) fmt::print("F{0:X}66: Load V0-V{0:X} with values from memory starting at address in I. I += 1 for each value read.", NB(opcode));
-                    for(int r = 0; r <= bits.n.b; r++) {
-                        v[r] = ram[I];
-                        I++;
-                    }
-                    break;
+    auto finish = std::chrono::steady_clock::now();
+    double seconds = std::chrono::duration<double>(finish - begin).count();
 
-                default:
-                    break;
-            }
-            break;
-        default:
-            break;
+    printf("instructions: %llu\n", (unsigned long long)chip.cycles);
+    printf("elapsed: %.6f s\n", seconds);
+    if (seconds > 0)
+        printf("speed: %.0f instructions/s\n", chip.cycles / seconds);
+}
+
+// Run the loaded program in many lanes at once with the lockstep engine and
+// report throughput.
+void runLockstep(int lanes, u64 frames)
+{
+    std::unique_ptr<Lockstep> group(new Lockstep(lanes));
+    group->fill(chip);
+
+    auto begin = std::chrono::steady_clock::now();
+    group->runFrames(frames);
+    auto finish = std::chrono::steady_clock::now();
+    double seconds = std::chrono::duration<double>(finish - begin).count();
+
+    u64 steps = group->uniformSteps + group->scalarSteps;
+    printf("lanes: %d\n", group->lanes());
+    printf("instructions per lane: %llu\n", (unsigned long long)group->cycles);
+    printf("elapsed: %.6f s\n", seconds);
+    if (steps)
+        printf("lockstep: %.1f%% of group instructions\n", 100.0 * group->uniformSteps / steps);
+    if (seconds > 0) {
+        printf("speed: %.0f lane frames/s\n", group->lanes() * frames / seconds);
+        printf("speed: %.0f lane instructions/s\n", group->lanes() * group->cycles / seconds);
     }
-    //if (verbose) fmt::print("\n");
+}
 
+// Replay a recording made with --record-input as fast as possible and check
+// that the machine ends up in the same state. The machine must have been
+// reset with the recording's seed and speed and have the program loaded.
+int runReplay(InputLog &log)
+{
+    if (chip.stateHash() != log.startHash) {
+        printf("ERROR: the recording was made with another program!\n");
+        return 1;
+    }
 
-    return 2;
+    auto begin = std::chrono::steady_clock::now();
+    for (u64 f = 0; f < log.frames; f++) {
+        log.replay(f, chip.key);
+        chip.runFrame();
+        if (video)
+            video->push(chip.display, true);
+    }
+    auto finish = std::chrono::steady_clock::now();
+    double seconds = std::chrono::duration<double>(finish - begin).count();
+
+    u64 hash = chip.stateHash();
+    printf("frames: %llu\n", (unsigned long long)log.frames);
+    printf("instructions: %llu\n", (unsigned long long)chip.cycles);
+    printf("elapsed: %.6f s\n", seconds);
+    if (seconds > 0)
+        printf("speed: %.0f frames/s\n", log.frames / seconds);
+    printf("final state: %016llx (%s)\n", (unsigned long long)hash, hash == log.finalHash ? "OK" : "MISMATCH");
+    return hash == log.finalHash ? 0 : 1;
 }
 
-std::map<uint16_t, std::string> disassemble(uint16_t start, uint16_t end)
+// Print the profile and write the call graph
+void finishProfile()
 {
-    std::map<uint16_t, std::string> output;
-    uint16_t addr = start;
-    uint16_t line;
-    opcodeBits bits;
-
-    auto hex = [](uint32_t n, uint8_t d)
-    {
-        std::string s(d, '0');
-		for (int i = d - 1; i >= 0; i--, n >>= 4)
-			s[i] = "0123456789ABCDEF"[n & 0xF];
-		return s;
-    };
-
-    while (addr <= end) {
-        line = addr;
-        bits.opcode = (ram[addr] << 8) | ram[addr+1];
-        std::string text = "0x" + hex(addr, 4) + ": " + hex(bits.opcode, 4) + " - ";
-
-        addr += 2;
-        int what = bits.n.a;
-        switch (what) {
-            case 0:
-                if (bits.b.b == 0x00E0) {
-                    text += "CLS";
-                } else if (bits.b.b == 0x00EE) {
-                    text += "RTS";
-                } else {
-                    text += "CALL RCA1802 0x" + hex(bits.t.b, 4);
-                }
-                break;
-            case 1:
-                text += "JMP  0x" + hex(bits.t.b, 4); break;
-            case 2:
-                text += "CALL 0x" + hex(bits.t.b, 4); break;
-            case 3:
-                text += "SKIP if V" + hex(bits.n.b, 1) + " == " + hex(bits.b.b, 2); break;
-            case 4:
-                text += "SKIP if V" + hex(bits.n.b, 1) + " != " + hex(bits.b.b, 2); break;
-            case 5:
-                text += "SKIP if V" + hex(bits.n.b, 1) + " == " + "V" + hex(bits.n.c, 1); break;
-            case 6:
-                text += "LOAD V" + hex(bits.n.b, 1) + ", " + hex(bits.b.b, 2); break;
-            case 7:
-                text += "ADD  V" + hex(bits.n.b, 1) + ", " + hex(bits.b.b, 2); break;
-            case 8:
-                switch (bits.n.d) {
-                    case 0:
-                        text += "LOAD V" + hex(bits.n.b, 1) + ", V" + hex(bits.n.c, 1); break;
-                    case 1:
-                        text += "OR   V" + hex(bits.n.b, 1) + ", V" + hex(bits.n.c, 1); break;
-                    case 2:
-                        text += "AND  V" + hex(bits.n.b, 1) + ", V" + hex(bits.n.c, 1); break;
-                    case 3:
-                        text += "XOR  V" + hex(bits.n.b, 1) + ", V" + hex(bits.n.c, 1); break;
-                    case 4:
-                        text += "ADD  V" + hex(bits.n.b, 1) + ", V" + hex(bits.n.c, 1); break;
-                    case 5:
-                        text += "SUB  V" + hex(bits.n.b, 1) + ", V" + hex(bits.n.c, 1); break;
-                    case 6:
-                        text += "RSH  V" + hex(bits.n.b, 1); break;
-                    case 7:
-                        text += "SUBX V" + hex(bits.n.c, 1) + ", V" + hex(bits.n.b, 1); break;
-                    case 0xE:
-                        text += "LSH  V" + hex(bits.n.b, 1); break;
-                    default:
-                        text += "???"; break;
-                }
-                break;
-            case 9:
-                text += "SKIP if V" + hex(bits.n.b, 1) + " != " + "V" + hex(bits.n.c, 1); break;
-            case 0xA:
-                text += "LOAD I, " + hex(bits.t.b, 3); break;
-            case 0xB:
-                text += "JMP  " + hex(bits.t.b, 3) + ", V0"; break;
-            case 0xC:
-                text += "LOAD V" + hex(bits.n.b, 1) + ", RND(" + hex(bits.b.b, 2) + ")"; break;
-            case 0xD:
-                text += "DRAW V" + hex(bits.n.b, 1) + ", V" + hex(bits.n.c, 1) + ", " + hex(bits.n.d, 1); break;
-            case 0xE:
-                switch(bits.b.b) {
-                    case 0x9E: text += "KEYP V" + hex(bits.n.b, 1); break;
-                    case 0xA1: text += "KEYR V" + hex(bits.n.b, 1); break;
-                    default: text += "???"; break;
-                }
-                break;
-            case 0xF:
-                switch (bits.b.b) {
-                    case 0x07: text += "LOAD V" + hex(bits.n.b, 1) + ", dTIM"; break;
-                    case 0x0A: text += "LOAD V" + hex(bits.n.b, 1) + ", KEY"; break;
-                    case 0x15: text += "LOAD dTIM, V" + hex(bits.n.b, 1); break;
-                    case 0x18: text += "LOAD sTIM, V" + hex(bits.n.b, 1); break;
-                    case 0x1E: text += "ADD  I, V" + hex(bits.n.b, 1); break;
-                    case 0x29: text += "LOAD I, SPR(V" + hex(bits.n.b, 1) + ")"; break;
-                    case 0x33: text += "LOAD I, BCD(V" + hex(bits.n.b, 1) + ")"; break;
-                    case 0x55: text += "DUMP V0 - V" + hex(bits.n.b, 1); break;
-                    case 0x66: text += "LOAD V0 - V" + hex(bits.n.b, 1); break;
-                    default:   text += "???"; break;
-                }
-                break;
-            default:
-                text += "???";
-                break;
+    printf("\n");
+    profiler->report(stdout, chip);
+    if (profiler->writeFolded(profilePath.c_str()))
+        printf("\n[call graph written to %s]\n", profilePath.c_str());
+    else
+        printf("ERROR: couldn't write the call graph to %s!\n", profilePath.c_str());
+}
+
+// Write the rest of the video and close it
+void finishVideo()
+{
+    bool ok = video->close();
+    printf("[%llu frames of video written to %s", (unsigned long long)video->written(), videoPath.c_str());
+    if (video->dropped())
+        printf(", %llu dropped", (unsigned long long)video->dropped());
+    printf("]\n");
+    if (!ok)
+        printf("ERROR: couldn't write all of %s!\n", videoPath.c_str());
+}
+
+// Run every ROM in dir and print one line per ROM:
+//   <display hash> <instructions> <seconds> <name>
+int runBatchMode(const std::string &dir, u64 frames, int jobs, const QuirksDatabase *quirksDb)
+{
+    BatchOptions options;
+    options.frames = frames;
+    options.cyclesPerFrame = chip.cyclesPerFrame;
+    options.seed = chip.seed;
+    options.engine = chip.engine;
+    options.quirks = chip.quirks;
+    options.quirksDb = quirksDb;
+    options.jobs = jobs;
+
+    std::vector<BatchResult> results;
+    auto begin = std::chrono::steady_clock::now();
+    if (!runBatch(dir, options, results)) {
+        printf("ERROR: couldn't read directory %s!\n", dir.c_str());
+        return 1;
+    }
+    auto finish = std::chrono::steady_clock::now();
+
+    int failed = 0;
+    u64 instructions = 0;
+    for (const BatchResult &r : results) {
+        if (!r.loaded) {
+            printf("%-16s %12s %10s %s\n", "ERROR", "-", "-", r.name.c_str());
+            failed++;
+            continue;
         }
+        printf("%016llx %12llu %10.6f %s\n", (unsigned long long)r.displayHash,
+                (unsigned long long)r.instructions, r.seconds, r.name.c_str());
+        instructions += r.instructions;
+    }
+
+    double seconds = std::chrono::duration<double>(finish - begin).count();
+    printf("# %zu roms, %d failed, %llu instructions, %.6f s\n", results.size(), failed,
+            (unsigned long long)instructions, seconds);
+    return failed ? 1 : 0;
+}
 
-        output[line] = text;
+// Disassemble every ROM in dir and print the listings one after the other,
+// each headed by its file name
+int runDisasmBatch(const std::string &dir, int jobs)
+{
+    std::vector<DisasmResult> results;
+    if (!disassembleBatch(dir, jobs, results)) {
+        printf("ERROR: couldn't read directory %s!\n", dir.c_str());
+        return 1;
     }
 
-    return output;
+    int failed = 0;
+    for (const DisasmResult &r : results) {
+        if (!r.loaded) {
+            printf("; %s: ERROR: couldn't load file!\n\n", r.name.c_str());
+            failed++;
+            continue;
+        }
+        printf("; %s\n", r.name.c_str());
+        fwrite(r.listing.data(), 1, r.listing.size(), stdout);
+        printf("\n");
+    }
+    return failed ? 1 : 0;
 }
 
 int main(int argc, char *argv[])
 {
-    FILE *f;
     int filesize = 0;
     std::string arg;
-    char *filename;
+    const char *filename = nullptr;
     bool disasmOnly = false;
+    bool translate = false;
+    const char *outputPath = nullptr;
+    bool headless = false;
+    u64 headlessCycles = 0, headlessFrames = 600;
+    std::string batchDir;
+    int jobs = 0;
+    int lanes = 0;
+    bool seedGiven = false;
+    const char *replayPath = nullptr;
+    long rewindMB = 16;
+    int videoScale = 1;
+    std::vector<Debugger::Breakpoint> breakpoints;
+    std::vector<Debugger::Watchpoint> watchpoints;
+    bool quirksGiven = false;
+    const char *quirksDbPath = nullptr;
+    QuirksDatabase quirksDb;
+    int status = 0;
+
+    // A chipit built with a program translated ahead of time runs that one,
+    // natively, unless told otherwise
+    if (aotProgram) {
+        chip.engine = Engine::Aot;
+        chip.quirks = aotProgram->quirks;
+    }
     
-    if(argc < 2) {
-        printf("syntax: chipit [-d | -r] FILENAME\n");
+    if(argc < 2 && !aotProgram) {
+        printf("syntax: chipit [-d | -r | --headless [--cycles N | --frames N]] [--engine switch|table|predecode|block|jit|aot] [--cpf N] [--quirks modern|cosmac|schip|xochip] [--quirks-db FILE] [--seed N] [--rewind MB] [--turbo N] [--break ADDR[:COND]] [--watch ADDR[-ADDR][:r|w|rw]] [--record-input FILE] [--record FILE [--record-scale N]] [--profile FILE] FILENAME\n");
+        printf("       chipit --replay FILE [--engine ...] [--profile FILE] [--record FILE [--record-scale N]] FILENAME\n");
+        printf("       chipit --batch DIR [--frames N] [--jobs N] [--engine ...] [--cpf N] [--quirks ...] [--quirks-db FILE]\n");
+        printf("       chipit -d --batch DIR [--jobs N]\n");
+        printf("       chipit --aot FILENAME -o FILE.cpp [--quirks ...] [--quirks-db FILE]\n");
+        printf("       chipit --lockstep LANES [--frames N] [--cpf N] FILENAME\n");
         return 0;
     }
-        
-    arg = argv[1];
 
-    srand (time(NULL));
+    for (int i = 1; i < argc; i++) {
+        arg = argv[i];
+        if (arg == "-d") {
+            disasmOnly = true;
+        } else if (arg == "-r") {
+            disasmOnly = false;
+        } else if (arg == "--aot") {
+            translate = true;
+        } else if (arg == "-o" && i + 1 < argc) {
+            outputPath = argv[++i];
+        } else if (arg == "--headless") {
+            headless = true;
+        } else if (arg == "--cycles" && i + 1 < argc) {
+            headlessCycles = strtoull(argv[++i], nullptr, 0);
+        } else if (arg == "--frames" && i + 1 < argc) {
+            headlessFrames = strtoull(argv[++i], nullptr, 0);
+        } else if (arg == "--batch" && i + 1 < argc) {
+            batchDir = argv[++i];
+        } else if (arg == "--lockstep" && i + 1 < argc) {
+            lanes = atoi(argv[++i]);
+        } else if (arg == "--seed" && i + 1 < argc) {
+            chip.seed = strtoul(argv[++i], nullptr, 0);
+            seedGiven = true;
+        } else if (arg == "--record-input" && i + 1 < argc) {
+            recordPath = argv[++i];
+        } else if (arg == "--record" && i + 1 < argc) {
+            videoPath = argv[++i];
+        } else if (arg == "--record-scale" && i + 1 < argc) {
+            long scale = strtol(argv[++i], nullptr, 0);
+            if (scale < 1 || scale > 16) {
+                printf("ERROR: --record-scale must be between 1 and 16!\n");
+                return 1;
+            }
+            videoScale = scale;
+        } else if (arg == "--replay" && i + 1 < argc) {
+            replayPath = argv[++i];
+        } else if (arg == "--profile" && i + 1 < argc) {
+            profilePath = argv[++i];
+        } else if (arg == "--rewind" && i + 1 < argc) {
+            rewindMB = strtol(argv[++i], nullptr, 0);
+        } else if (arg == "--turbo" && i + 1 < argc) {
+            long speed = strtol(argv[++i], nullptr, 0);
+            if (speed < 0 || speed > 1000) {
+                printf("ERROR: --turbo must be between 0 and 1000!\n");
+                return 1;
+            }
+            turboSpeed = speed;
+            fastForward = true;
+        } else if (arg == "--break" && i + 1 < argc) {
+            Debugger::Breakpoint b;
+            if (!Debugger::parseBreakpoint(argv[++i], b)) {
+                printf("ERROR: bad breakpoint %s!\n", argv[i]);
+                return 1;
+            }
+            breakpoints.push_back(b);
+        } else if (arg == "--watch" && i + 1 < argc) {
+            Debugger::Watchpoint w;
+            if (!Debugger::parseWatchpoint(argv[++i], w)) {
+                printf("ERROR: bad watchpoint %s!\n", argv[i]);
+                return 1;
+            }
+            watchpoints.push_back(w);
+        } else if (arg == "--jobs" && i + 1 < argc) {
+            jobs = atoi(argv[++i]);
+        } else if (arg == "--cpf" && i + 1 < argc) {
+            long cpf = strtol(argv[++i], nullptr, 0);
+            if (cpf < 1 || cpf > 1000000) {
+                printf("ERROR: --cpf must be between 1 and 1000000!\n");
+                return 1;
+            }
+            chip.cyclesPerFrame = cpf;
+        } else if (arg == "--quirks" && i + 1 < argc) {
+            if (!parseQuirks(argv[++i], chip.quirks)) {
+                printf("ERROR: unknown quirks %s!\n", argv[i]);
+                return 1;
+            }
+            quirksGiven = true;
+        } else if (arg == "--quirks-db" && i + 1 < argc) {
+            quirksDbPath = argv[++i];
+        } else if (arg == "--engine" && i + 1 < argc) {
+            arg = argv[++i];
+            if (arg == "switch") {
+                chip.engine = Engine::Switch;
+            } else if (arg == "predecode") {
+                chip.engine = Engine::Predecode;
+            } else if (arg == "block") {
+                chip.engine = Engine::Block;
+            } else if (arg == "table") {
+                chip.engine = Engine::Table;
+            } else if (arg == "aot") {
+                if (!aotProgram) {
+                    printf("ERROR: no program was translated into this chipit, see --aot!\n");
+                    return 1;
+                }
+                chip.engine = Engine::Aot;
+            } else if (arg == "jit") {
+                if (Jit::supported()) {
+                    chip.engine = Engine::Jit;
+                } else {
+                    printf("WARNING: no JIT for this platform, using the block engine.\n");
+                    chip.engine = Engine::Block;
+                }
+            } else {
+                printf("ERROR: unknown engine %s!\n", arg.c_str());
+                return 1;
+            }
+        } else {
+            filename = argv[i];
+        }
+    }
+
+    // --quirks wins over the database
+    if (quirksDbPath && !quirksDb.load(quirksDbPath)) {
+        printf("ERROR: couldn't read the quirks database %s!\n", quirksDbPath);
+        return 1;
+    }
+    bool lookUpQuirks = quirksDbPath && !quirksGiven;
+
+    if (!batchDir.empty() && disasmOnly)
+        return runDisasmBatch(batchDir, jobs);
+    if (!batchDir.empty())
+        return runBatchMode(batchDir, headlessFrames, jobs, lookUpQuirks ? &quirksDb : nullptr);
+
+    if (translate && !outputPath) {
+        printf("ERROR: --aot needs an output file (-o FILE.cpp)!\n");
+        return 1;
+    }
+
+    bool builtIn = !filename && aotProgram;
+    if (builtIn)
+        filename = aotProgram->name;
+    if (!filename) {
+        printf("ERROR: no file given!\n");
+        return 1;
+    }
+
+    InputLog replayLog;
+    if (replayPath) {
+        if (!replayLog.load(replayPath)) {
+            printf("ERROR: couldn't load recording %s!\n", replayPath);
+            return 1;
+        }
+        chip.seed = replayLog.seed;
+        chip.cyclesPerFrame = replayLog.cyclesPerFrame;
+    } else if (!seedGiven) {
+        chip.seed = time(NULL);
+    }
+
+    if (!profilePath.empty()) {
+        profiler.reset(new Profiler);
+        chip.profiler = profiler.get();
+    }
     
     printf("\n\n     CHIPIT v1.0\n\n");
 
     printf("[loading font sprites...]\n");
-    loadFont();
+    chip.reset();
 
     printf("[loading file...]\n");
 
-    if(arg == "-d") {
-        filename = argv[2];
-        disasmOnly = true;
-    } else {
-        filename = argv[1];
+    if (builtIn)
+        filesize = chip.loadRom(aotProgram->rom, aotProgram->size);
+    else
+        filesize = chip.loadRom(filename);
+    if (filesize < 0) {
+        printf("ERROR: couldn't load file %s!\n", filename);
+        return 1;
     }
 
-    f = fopen(filename, "rb");
-    fseek(f, 0L, SEEK_END);
-    filesize = ftell(f);
-    fseek(f, 0L, SEEK_SET);
-    fread(&ram[0x200], filesize, 1, f);
-
+    if (lookUpQuirks) {
+        u64 hash = hashRom(chip.ram + 0x200, filesize);
+        Quirks q;
+        if (quirksDb.find(hash, q)) {
+            chip.setQuirks(q);
+            printf("[quirks: %s]\n", quirksName(q));
+        } else {
+            printf("[ROM %016llx isn't in %s, using the %s quirks]\n", (unsigned long long)hash,
+                    quirksDbPath, quirksName(chip.quirks));
+        }
+    }
 
-    disasm = disassemble(0x200, filesize+0x200);
+    // Video of everything that runs the program frame by frame
+    if (!videoPath.empty() && !disasmOnly && !translate && lanes <= 0) {
+        if (headless && headlessCycles) {
+            printf("ERROR: video is recorded by frames, use --frames rather than --cycles!\n");
+            return 1;
+        }
+        video.reset(new VideoRecorder(videoScale));
+        if (!video->open(videoPath.c_str())) {
+            printf("ERROR: couldn't create %s!\n", videoPath.c_str());
+            return 1;
+        }
+        printf("[recording %dx%d video to %s%s]\n", video->width(), video->height(), videoPath.c_str(),
+                video->y4m() ? "" : " as raw 8-bit grey frames at 60 fps");
+    }
 
     if (disasmOnly) {
         printf("[decoding opcodes...]\n\n");
-        for (auto it = disasm.begin(); it != disasm.end(); it++) {
-            std::cout << it->second << std::endl;
+        CodeMap map;
+        std::string listing;
+        analyzeFlow(chip.ram, 0x200 + filesize, map);
+        listProgram(chip.ram, map, listing);
+        fwrite(listing.data(), 1, listing.size(), stdout);
+    } else if (translate) {
+        printf("[translating to %s...]\n", outputPath);
+        CodeMap map;
+        std::string source;
+        analyzeFlow(chip.ram, 0x200 + filesize, map);
+        const char *name = strrchr(filename, '/');
+        translateProgram(chip.ram, map, name ? name + 1 : filename, chip.quirks, source);
+
+        FILE *f = fopen(outputPath, "w");
+        if (!f || fwrite(source.data(), 1, source.size(), f) != source.size()) {
+            printf("ERROR: couldn't write %s!\n", outputPath);
+            status = 1;
         }
+        if (f && fclose(f) != 0)
+            status = 1;
+    } else if (replayPath) {
+        printf("[replaying %s...]\n", replayPath);
+        status = runReplay(replayLog);
+    } else if (lanes > 0) {
+        printf("[running %d lanes in lockstep...]\n", lanes);
+        runLockstep(lanes, headlessFrames);
+    } else if (headless) {
+        printf("[running emulator headless...]\n");
+        runHeadless(headlessCycles, headlessFrames);
     } else {
         printf("[running emulator...]\n");
+        statePath = std::string(filename) + ".state";
+        if (rewindMB > 0)
+            history.reset(new Rewind(rewindMB << 20));
+        if (!recordPath.empty()) {
+            recording.reset(new InputLog);
+            recording->seed = chip.seed;
+            recording->cyclesPerFrame = chip.cyclesPerFrame;
+            recording->startHash = chip.stateHash();
+            printf("[recording input to %s, the seed is %u]\n", recordPath.c_str(), chip.seed);
+        }
+        if (!breakpoints.empty() || !watchpoints.empty()) {
+            if (recording || profiler) {
+                printf("WARNING: no breakpoints or watchpoints while recording input or profiling.\n");
+            } else {
+                debugger.reset(new Debugger(chip));
+                for (const auto &b : breakpoints)
+                    debugger->addBreakpoint(b);
+                for (const auto &w : watchpoints)
+                    debugger->addWatchpoint(w);
+            }
+        }
         initSFML();
-        initPixelData();
-        initEmulator();
         mainLoop();
     }
-    
+
+    if (profiler && !disasmOnly && !translate && lanes <= 0)
+        finishProfile();
+    if (video)
+        finishVideo();
     
     printf("\n[finished]\n\n");
-    return 0;
+    return status;
 }
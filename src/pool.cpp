@@ -0,0 +1,121 @@
+/*
+ *
+ * CHIPIT
+ *
+ * Work-stealing thread pool. See pool.h.
+ */
+
+#include "pool.h"
+
+// The pool and worker index of the current thread, if it's a worker
+static thread_local WorkPool *currentPool = nullptr;
+static thread_local int currentWorker = -1;
+
+WorkPool::WorkPool(int threads)
+{
+    if (threads < 1)
+        threads = std::thread::hardware_concurrency();
+    if (threads < 1)
+        threads = 1;
+
+    next = 0;
+    queued = 0;
+    unfinished = 0;
+    stopping = false;
+
+    for (int i = 0; i < threads; i++)
+        queues.emplace_back(new Queue);
+    for (int i = 0; i < threads; i++)
+        workers.emplace_back(&WorkPool::work, this, i);
+}
+
+WorkPool::~WorkPool()
+{
+    wait();
+    {
+        std::lock_guard<std::mutex> l(lock);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (auto &w : workers)
+        w.join();
+}
+
+void WorkPool::submit(Task task)
+{
+    // Count the task before it's visible, so that a worker finishing it can
+    // never see the counters drop below the real number of tasks
+    int q;
+    {
+        std::lock_guard<std::mutex> l(lock);
+        if (currentPool == this)
+            q = currentWorker;
+        else
+            q = next++ % queues.size();
+        queued++;
+        unfinished++;
+    }
+
+    {
+        std::lock_guard<std::mutex> l(queues[q]->lock);
+        queues[q]->tasks.push_back(std::move(task));
+    }
+    wake.notify_one();
+}
+
+void WorkPool::wait()
+{
+    std::unique_lock<std::mutex> l(lock);
+    idle.wait(l, [this] { return unfinished == 0; });
+}
+
+// Newest task of our own queue, or else the oldest one of somebody else's
+bool WorkPool::take(int self, Task &task)
+{
+    int n = queues.size();
+    for (int i = 0; i < n; i++) {
+        Queue &q = *queues[(self + i) % n];
+        std::lock_guard<std::mutex> l(q.lock);
+        if (q.tasks.empty())
+            continue;
+        if (i == 0) {
+            task = std::move(q.tasks.back());
+            q.tasks.pop_back();
+        } else {
+            task = std::move(q.tasks.front());
+            q.tasks.pop_front();
+        }
+        return true;
+    }
+    return false;
+}
+
+void WorkPool::work(int self)
+{
+    currentPool = this;
+    currentWorker = self;
+
+    for (;;) {
+        Task task;
+        if (take(self, task)) {
+            {
+                std::lock_guard<std::mutex> l(lock);
+                queued--;
+            }
+            task();
+            task = nullptr;
+
+            std::lock_guard<std::mutex> l(lock);
+            if (--unfinished == 0)
+                idle.notify_all();
+            continue;
+        }
+
+        // Nothing to take. Sleep until something is queued, but don't miss a
+        // task that was pushed after we looked.
+        std::unique_lock<std::mutex> l(lock);
+        wake.wait(l, [this] { return stopping || queued > 0; });
+        if (stopping && queued == 0)
+            return;
+    }
+}
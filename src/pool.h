@@ -0,0 +1,62 @@
+/*
+ *
+ * CHIPIT
+ *
+ * Work-stealing thread pool.
+ *
+ * Every worker has its own queue of tasks. A worker takes the newest task from
+ * its own queue, and when that's empty steals the oldest task from another
+ * worker's queue. Tasks submitted from outside the pool are spread over the
+ * queues round robin; tasks submitted by a running task go to the queue of
+ * the worker running it.
+ */
+
+#ifndef POOL_H
+#define POOL_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class WorkPool {
+    public:
+        typedef std::function<void()> Task;
+
+        // Start the given number of workers, or one per core if threads < 1
+        explicit WorkPool(int threads = 0);
+        // Waits for all tasks to finish
+        ~WorkPool();
+
+        void submit(Task task);
+
+        // Block until every task submitted so far has finished
+        void wait();
+
+        int size() const { return workers.size(); }
+
+    private:
+        struct Queue {
+            std::mutex lock;
+            std::deque<Task> tasks;
+        };
+
+        bool take(int self, Task &task);
+        void work(int self);
+
+        std::vector<std::unique_ptr<Queue>> queues;
+        std::vector<std::thread> workers;
+        unsigned next;                  // queue for the next task from outside
+
+        std::mutex lock;                // protects the counters below
+        std::condition_variable wake;   // tasks were queued, or we're stopping
+        std::condition_variable idle;   // unfinished dropped to 0
+        int queued;                     // tasks sitting in the queues
+        int unfinished;                 // tasks submitted but not finished
+        bool stopping;
+};
+
+#endif
@@ -0,0 +1,236 @@
+/*
+ *
+ * CHIPIT
+ *
+ * Execution profiler. See profile.h.
+ */
+
+#include <algorithm>
+#include <cstring>
+
+#include "profile.h"
+#include "disasm.h"
+
+const char *const Profiler::typeNames[Types] = {
+    "00E0 CLS", "00EE RET", "0nnn SYS", "1nnn JP", "2nnn CALL",
+    "3xkk SE", "4xkk SNE", "5xy0 SE", "6xkk LD", "7xkk ADD",
+    "8xy0 LD", "8xy1 OR", "8xy2 AND", "8xy3 XOR", "8xy4 ADD",
+    "8xy5 SUB", "8xy6 SHR", "8xy7 SUBN", "8xyE SHL", "9xy0 SNE",
+    "Annn LD I", "Bnnn JP V0", "Cxkk RND", "Dxyn DRW", "Ex9E SKP",
+    "ExA1 SKNP", "Fx07 LD DT", "Fx0A LD K", "Fx15 LD DT", "Fx18 LD ST",
+    "Fx1E ADD I", "Fx29 LD F", "Fx33 LD B", "Fx55 LD [I]", "Fx65 LD [I]",
+    "00Cn SCD", "00Dn SCU", "00FB SCR", "00FC SCL", "00FD EXIT",
+    "00FE LOW", "00FF HIGH", "Fn01 PLANE", "Fx30 LD HF", "Fx75 LD R",
+    "Fx85 LD R", "invalid",
+};
+
+u8 Profiler::typeOf[65536];
+
+static u8 classify(u16 op)
+{
+    const u8 invalid = 46;
+    u8 kk = op & 0xFF;
+
+    switch (op >> 12) {
+        case 0x0:
+            if ((op & 0xFFF0) == 0x00C0)
+                return 35;
+            if ((op & 0xFFF0) == 0x00D0)
+                return 36;
+            if (op >= 0x00FB && op <= 0x00FF)
+                return 37 + (op - 0x00FB);
+            return op == 0x00E0 ? 0 : op == 0x00EE ? 1 : 2;
+        case 0x8:
+            switch (op & 0xF) {
+                case 0x0: case 0x1: case 0x2: case 0x3:
+                case 0x4: case 0x5: case 0x6: case 0x7:
+                    return 10 + (op & 0xF);
+                case 0xE:
+                    return 18;
+                default:
+                    return invalid;
+            }
+        case 0xE:
+            return kk == 0x9E ? 24 : kk == 0xA1 ? 25 : invalid;
+        case 0xF:
+            switch (kk) {
+                case 0x01: return 42;
+                case 0x07: return 26;
+                case 0x0A: return 27;
+                case 0x15: return 28;
+                case 0x18: return 29;
+                case 0x1E: return 30;
+                case 0x29: return 31;
+                case 0x33: return 32;
+                case 0x55: return 33;
+                case 0x65: return 34;
+                case 0x30: return 43;
+                case 0x75: return 44;
+                case 0x85: return 45;
+                default:   return invalid;
+            }
+        case 0x9:
+            return 19;
+        default:
+            // 1nnn - 7xkk and Annn - Dxyn are one type each. 5xy0 and 9xy0
+            // don't check their last nibble when executed either.
+            return (op >> 12) < 8 ? 2 + (op >> 12) : 20 + (op >> 12) - 0xA;
+    }
+}
+
+Profiler::Profiler()
+{
+    // Fill the table on first use
+    static const bool classified = [] {
+        for (u32 op = 0; op < 65536; op++)
+            typeOf[op] = classify(op);
+        return true;
+    }();
+    (void)classified;
+
+    std::memset(typeCounts, 0, sizeof(typeCounts));
+    std::memset(pcCounts, 0, sizeof(pcCounts));
+
+    nodes.push_back(Node{ 0, -1, 0, 0 });
+    current = 0;
+    for (int &c : callers)
+        c = 0;
+}
+
+int Profiler::child(int parent, u16 addr)
+{
+    // Runaway recursion could create chains without end. Past this many,
+    // calls are counted in the caller.
+    const size_t maxNodes = 1 << 16;
+
+    u32 key = (u32)parent << 12 | addr;
+    auto it = children.find(key);
+    if (it != children.end())
+        return it->second;
+    if (nodes.size() >= maxNodes)
+        return parent;
+
+    nodes.push_back(Node{ addr, parent, 0, 0 });
+    children[key] = nodes.size() - 1;
+    return nodes.size() - 1;
+}
+
+std::string Profiler::path(int node) const
+{
+    std::vector<u16> addrs;
+    for (; node > 0; node = nodes[node].parent)
+        addrs.push_back(nodes[node].addr);
+
+    std::string s = "main";
+    char name[16];
+    for (auto it = addrs.rbegin(); it != addrs.rend(); it++) {
+        snprintf(name, sizeof(name), ";sub_0x%04X", *it);
+        s += name;
+    }
+    return s;
+}
+
+u64 Profiler::total() const
+{
+    u64 n = 0;
+    for (u64 c : typeCounts)
+        n += c;
+    return n;
+}
+
+void Profiler::report(FILE *f, const Machine &m) const
+{
+    const int hottest = 20;
+    u64 all = total();
+    if (!all) {
+        fprintf(f, "# profile: nothing was run\n");
+        return;
+    }
+    double msPerInstruction = 1000.0 / (60.0 * m.cyclesPerFrame);
+    auto percent = [all](u64 n) { return 100.0 * n / all; };
+
+    fprintf(f, "# profile: %llu instructions, %.1f ms emulated\n",
+            (unsigned long long)all, all * msPerInstruction);
+
+    // Opcode types, most executed first
+    std::vector<int> types;
+    for (int t = 0; t < Types; t++)
+        if (typeCounts[t])
+            types.push_back(t);
+    std::sort(types.begin(), types.end(), [this](int a, int b) {
+        return typeCounts[a] != typeCounts[b] ? typeCounts[a] > typeCounts[b] : a < b;
+    });
+
+    fprintf(f, "\n# opcode types\n");
+    for (int t : types)
+        fprintf(f, "%-12s %14llu %6.2f%%\n", typeNames[t], (unsigned long long)typeCounts[t], percent(typeCounts[t]));
+
+    // The hottest addresses, with what's there now
+    std::vector<u16> pcs;
+    for (int a = 0; a < 4096; a++)
+        if (pcCounts[a])
+            pcs.push_back(a);
+    std::sort(pcs.begin(), pcs.end(), [this](u16 a, u16 b) {
+        return pcCounts[a] != pcCounts[b] ? pcCounts[a] > pcCounts[b] : a < b;
+    });
+    if (pcs.size() > hottest)
+        pcs.resize(hottest);
+
+    fprintf(f, "\n# hottest addresses\n");
+    char line[disasmLineSize];
+    for (u16 a : pcs) {
+        u16 op = m.ram[a] << 8 | m.ram[(a + 1) & 0xFFF];
+        fprintf(f, "%14llu %6.2f%%  %s\n", (unsigned long long)pcCounts[a], percent(pcCounts[a]),
+                formatInstruction(a, op, line));
+    }
+
+    // Subroutines: calls, instructions run in them directly (self) and
+    // including everything they call (total). A subroutine that is part of
+    // a chain more than once (recursion) is only counted once per chain.
+    struct Sub {
+        u64 calls, self, total;
+    };
+    std::map<u16, Sub> subs;
+    for (size_t n = 1; n < nodes.size(); n++) {
+        Sub &s = subs[nodes[n].addr];
+        s.calls += nodes[n].calls;
+        s.self += nodes[n].self;
+    }
+    for (size_t n = 1; n < nodes.size(); n++) {
+        std::vector<u16> seen;
+        for (int p = n; p > 0; p = nodes[p].parent) {
+            if (std::find(seen.begin(), seen.end(), nodes[p].addr) != seen.end())
+                continue;
+            seen.push_back(nodes[p].addr);
+            subs[nodes[p].addr].total += nodes[n].self;
+        }
+    }
+
+    std::vector<std::pair<u16, Sub>> sorted(subs.begin(), subs.end());
+    std::sort(sorted.begin(), sorted.end(), [](const std::pair<u16, Sub> &a, const std::pair<u16, Sub> &b) {
+        return a.second.total != b.second.total ? a.second.total > b.second.total : a.first < b.first;
+    });
+
+    fprintf(f, "\n# subroutines\n");
+    fprintf(f, "%-8s %12s %14s %14s %7s %12s\n", "addr", "calls", "self", "total", "", "ms");
+    fprintf(f, "%-8s %12s %14llu %14llu %6.2f%% %12.1f\n", "main", "-",
+            (unsigned long long)nodes[0].self, (unsigned long long)all, 100.0, all * msPerInstruction);
+    for (const auto &s : sorted) {
+        fprintf(f, "0x%04X   %12llu %14llu %14llu %6.2f%% %12.1f\n", s.first,
+                (unsigned long long)s.second.calls, (unsigned long long)s.second.self,
+                (unsigned long long)s.second.total, percent(s.second.total), s.second.total * msPerInstruction);
+    }
+}
+
+bool Profiler::writeFolded(const char *filename) const
+{
+    FILE *f = fopen(filename, "w");
+    if (!f)
+        return false;
+
+    for (size_t n = 0; n < nodes.size(); n++) {
+        if (nodes[n].self)
+            fprintf(f, "%s %llu\n", path(n).c_str(), (unsigned long long)nodes[n].self);
+    }
+    return fclose(f) == 0;
+}
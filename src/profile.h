@@ -0,0 +1,85 @@
+/*
+ *
+ * CHIPIT
+ *
+ * Execution profiler. When a Machine has a profiler attached, every
+ * instruction is counted by opcode type and by address, and attributed to the
+ * chain of subroutines (2nnn) it runs in. The chain follows the machine's own
+ * stack, so it stays in step with programs that return from somewhere else
+ * than where they were called or nest deeper than the stack.
+ *
+ * Machine::runCycles() only checks for a profiler once per call and then runs
+ * a separate loop, so there's no cost at all when profiling is off. Profiled
+ * code is always run with executeOpcode(), whatever the engine.
+ */
+
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdio.h>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "machine.h"
+
+class Profiler {
+    public:
+        Profiler();
+
+        // Count the instruction at PC, which is about to be executed
+        void count(const Machine &m)
+        {
+            u16 pc = m.pc & 0xFFF;
+            u16 op = m.ram[pc] << 8 | m.ram[(pc + 1) & 0xFFF];
+            typeCounts[typeOf[op]]++;
+            pcCounts[pc]++;
+            nodes[current].self++;
+
+            if ((op & 0xF000) == 0x2000) {
+                callers[m.stackptr & 0xF] = current;
+                current = child(current, op & 0xFFF);
+                nodes[current].calls++;
+            } else if (op == 0x00EE) {
+                current = callers[(m.stackptr - 1) & 0xF];
+            }
+        }
+
+        // Print where the time went: opcode types, the hottest addresses and
+        // subroutines. Emulated time is derived from cyclesPerFrame.
+        void report(FILE *f, const Machine &m) const;
+
+        // Write the call graph as folded stacks, one line per chain of
+        // subroutines with the number of instructions run directly in it:
+        //   main;sub_0x0240;sub_0x0300 1234
+        // as read by flamegraph.pl and most other flame graph tools
+        bool writeFolded(const char *filename) const;
+
+        u64 total() const;
+
+    private:
+        // One chain of subroutines, from the top of the program down
+        struct Node {
+            u16 addr;            // subroutine address, 0 for the top
+            int parent;          // -1 for the top
+            u64 self;            // instructions run in this chain
+            u64 calls;
+        };
+
+        int child(int parent, u16 addr);
+        std::string path(int node) const;
+
+        enum { Types = 47 };
+        static const char *const typeNames[Types];
+        static u8 typeOf[65536];
+
+        u64 typeCounts[Types];
+        u64 pcCounts[4096];
+
+        std::vector<Node> nodes;
+        std::map<u32, int> children;     // parent << 12 | addr -> node
+        int current;
+        int callers[16];                 // node of the caller, by stack slot
+};
+
+#endif
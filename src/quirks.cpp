@@ -0,0 +1,99 @@
+/*
+ *
+ * CHIPIT
+ *
+ * Quirk profiles. See quirks.h.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <cstring>
+
+#include "quirks.h"
+
+static const struct {
+    Quirks id;
+    const char *name;
+    const char *policy;
+} profileNames[quirkProfiles] = {
+    { Quirks::Modern, "modern", "ModernQuirks" },
+    { Quirks::Cosmac, "cosmac", "CosmacQuirks" },
+    { Quirks::Schip, "schip", "SchipQuirks" },
+    { Quirks::Xochip, "xochip", "XochipQuirks" },
+};
+
+QuirkFlags quirkFlags(Quirks q)
+{
+    QuirkFlags f = {};
+    withQuirks(q, [&](auto policy) {
+        typedef decltype(policy) Q;
+        f = { Q::shiftVy, Q::keepI, Q::jumpVx, Q::clip };
+    });
+    return f;
+}
+
+const char *quirksName(Quirks q)
+{
+    return profileNames[(int)q].name;
+}
+
+const char *quirksPolicy(Quirks q)
+{
+    return profileNames[(int)q].policy;
+}
+
+bool parseQuirks(const char *name, Quirks &q)
+{
+    for (const auto &p : profileNames) {
+        if (std::strcmp(name, p.name) == 0) {
+            q = p.id;
+            return true;
+        }
+    }
+    return false;
+}
+
+uint64_t hashRom(const uint8_t *data, size_t size)
+{
+    uint64_t h = 0xcbf29ce484222325ull;
+    for (size_t i = 0; i < size; i++) {
+        h ^= data[i];
+        h *= 0x100000001b3ull;
+    }
+    return h;
+}
+
+bool QuirksDatabase::load(const char *filename)
+{
+    FILE *f = fopen(filename, "r");
+    if (!f)
+        return false;
+
+    char line[256];
+    bool ok = true;
+    while (ok && fgets(line, sizeof(line), f)) {
+        char *p = line + std::strspn(line, " \t");
+        if (*p == '#' || *p == '\n' || *p == '\r' || *p == 0)
+            continue;
+
+        char *end;
+        uint64_t hash = strtoull(p, &end, 16);
+        char name[32];
+        Quirks q;
+        ok = end != p && sscanf(end, "%31s", name) == 1 && parseQuirks(name, q);
+        if (ok)
+            profiles[hash] = q;
+    }
+
+    fclose(f);
+    return ok;
+}
+
+bool QuirksDatabase::find(uint64_t hash, Quirks &q) const
+{
+    auto it = profiles.find(hash);
+    if (it == profiles.end())
+        return false;
+    q = it->second;
+    return true;
+}
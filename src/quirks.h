@@ -0,0 +1,118 @@
+/*
+ *
+ * CHIPIT
+ *
+ * Quirk profiles: the behaviours that differ between CHIP-8 interpreters,
+ * and that programs written for one of them rely on.
+ *
+ * Every profile is a class of constants, one per quirk. The interpreters take
+ * it as a template parameter, so each profile compiles into code of its own
+ * without any tests for the quirks at run time. Which instantiation runs is
+ * decided once per call to Machine::runCycles() (see withQuirks()), the JIT
+ * and the aot translator look at the quirks when they generate code, and the
+ * predecoded handlers are picked when an instruction is decoded.
+ *
+ * The profile of a program can be given with --quirks, or looked up by the
+ * hash of the ROM in a database file (see QuirksDatabase).
+ */
+
+#ifndef QUIRKS_H
+#define QUIRKS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <unordered_map>
+
+enum class Quirks {
+    Modern,         // what chipit always did, and most programs expect
+    Cosmac,         // the original COSMAC VIP interpreter
+    Schip,          // SUPER-CHIP 1.1 on the HP 48
+    Xochip,         // XO-CHIP
+};
+
+const int quirkProfiles = 4;
+
+struct ModernQuirks {
+    static constexpr Quirks id = Quirks::Modern;
+    static constexpr bool shiftVy = false;  // 8xy6/8xyE shift Vy into Vx instead of shifting Vx
+    static constexpr bool keepI = false;    // Fx55/Fx65 leave I alone instead of I += x + 1
+    static constexpr bool jumpVx = false;   // Bxnn jumps to xnn + Vx instead of nnn + V0
+    static constexpr bool clip = false;     // Dxyn clips sprites at the edges instead of wrapping them
+};
+
+struct CosmacQuirks {
+    static constexpr Quirks id = Quirks::Cosmac;
+    static constexpr bool shiftVy = true;
+    static constexpr bool keepI = false;
+    static constexpr bool jumpVx = false;
+    static constexpr bool clip = true;
+};
+
+struct SchipQuirks {
+    static constexpr Quirks id = Quirks::Schip;
+    static constexpr bool shiftVy = false;
+    static constexpr bool keepI = true;
+    static constexpr bool jumpVx = true;
+    static constexpr bool clip = true;
+};
+
+struct XochipQuirks {
+    static constexpr Quirks id = Quirks::Xochip;
+    static constexpr bool shiftVy = true;
+    static constexpr bool keepI = false;
+    static constexpr bool jumpVx = false;
+    static constexpr bool clip = false;
+};
+
+// Call f with an object of the policy class of profile q, e.g.
+//   withQuirks(q, [&](auto policy) { run<decltype(policy)>(); });
+template <class F>
+void withQuirks(Quirks q, F &&f)
+{
+    switch (q) {
+        case Quirks::Modern: f(ModernQuirks()); break;
+        case Quirks::Cosmac: f(CosmacQuirks()); break;
+        case Quirks::Schip: f(SchipQuirks()); break;
+        case Quirks::Xochip: f(XochipQuirks()); break;
+    }
+}
+
+// The quirks of a profile as plain values, for the code generators, which
+// look at them while translating rather than while running
+struct QuirkFlags {
+    bool shiftVy;
+    bool keepI;
+    bool jumpVx;
+    bool clip;
+};
+QuirkFlags quirkFlags(Quirks q);
+
+// Name of a profile, as given to --quirks
+const char *quirksName(Quirks q);
+// Name of the policy class of a profile, for generated code
+const char *quirksPolicy(Quirks q);
+bool parseQuirks(const char *name, Quirks &q);
+
+// FNV-1a of a ROM image, the key of the database
+uint64_t hashRom(const uint8_t *data, size_t size);
+
+/*
+ * Profiles of known ROMs. The file has a line per ROM:
+ *   <hash> <profile> [anything, e.g. the name of the ROM]
+ * with the hash as hex digits (see hashRom()). Empty lines and lines
+ * starting with # are skipped.
+ */
+class QuirksDatabase {
+    public:
+        // Returns false if the file can't be read, or a line can't be parsed
+        // (the lines before it are kept)
+        bool load(const char *filename);
+
+        bool find(uint64_t hash, Quirks &q) const;
+        size_t size() const { return profiles.size(); }
+
+    private:
+        std::unordered_map<uint64_t, Quirks> profiles;
+};
+
+#endif
@@ -0,0 +1,130 @@
+/*
+ *
+ * CHIPIT
+ *
+ * Rewind buffer. See rewind.h.
+ *
+ * A delta is a list of runs over the XOR of two states, in 64-bit words. Each
+ * run is a header word (number of zero words to skip << 32 | number of
+ * literal words) followed by the literal words.
+ */
+
+#include <cstring>
+
+#include "rewind.h"
+
+Rewind::Rewind(size_t budget) : buffer(budget / 8)
+{
+    clear();
+    std::memset(newest, 0, sizeof(newest));
+}
+
+void Rewind::clear()
+{
+    entries.clear();
+    writePos = 0;
+    haveNewest = false;
+}
+
+size_t Rewind::used() const
+{
+    size_t words = 0;
+    for (const Entry &e : entries)
+        words += e.size;
+    return words * 8;
+}
+
+size_t Rewind::encode(const u64 *a, const u64 *b, u64 *out)
+{
+    size_t n = 0;
+    size_t i = 0;
+    while (i < stateWords) {
+        size_t zeros = 0;
+        for (; i < stateWords && a[i] == b[i]; i++)
+            zeros++;
+
+        // A single equal word between differing ones is cheaper to store than
+        // to start a new run for
+        size_t start = i;
+        while (i < stateWords && (a[i] != b[i] || (i + 1 < stateWords && a[i + 1] != b[i + 1])))
+            i++;
+
+        out[n++] = (u64)zeros << 32 | (i - start);
+        for (size_t j = start; j < i; j++)
+            out[n++] = a[j] ^ b[j];
+    }
+    return n;
+}
+
+void Rewind::decode(const u64 *in, u64 *state)
+{
+    size_t i = 0;
+    while (i < stateWords) {
+        u64 header = *in++;
+        i += header >> 32;
+        for (u32 lits = header & 0xFFFFFFFF; lits; lits--)
+            state[i++] ^= *in++;
+    }
+}
+
+// Make room for size words at writePos, dropping the oldest entries as needed
+bool Rewind::allocate(size_t size)
+{
+    if (size > buffer.size())
+        return false;
+
+    for (;;) {
+        if (entries.empty()) {
+            writePos = 0;
+            return true;
+        }
+
+        // Entries occupy [tail, writePos), possibly wrapping around the end
+        size_t tail = entries.front().offset;
+        if (writePos > tail) {
+            if (buffer.size() - writePos >= size)
+                return true;
+            writePos = 0;
+            continue;
+        }
+        if (writePos < tail && tail - writePos >= size)
+            return true;
+        entries.pop_front();
+    }
+}
+
+void Rewind::push(const MachineState &s)
+{
+    u64 state[stateWords];
+    state[stateWords - 1] = 0;
+    std::memcpy(state, &s, sizeof(s));
+
+    if (haveNewest) {
+        size_t size = encode(newest, state, scratch);
+        if (allocate(size)) {
+            std::memcpy(&buffer[writePos], scratch, size * 8);
+            entries.push_back({ writePos, size });
+            writePos += size;
+        } else {
+            // Doesn't fit at all: older states can't be reached any more
+            entries.clear();
+        }
+    }
+
+    std::memcpy(newest, state, sizeof(newest));
+    haveNewest = true;
+}
+
+bool Rewind::pop(MachineState &s)
+{
+    if (entries.empty())
+        return false;
+
+    Entry e = entries.back();
+    entries.pop_back();
+    decode(&buffer[e.offset], newest);
+    writePos = e.offset;
+
+    std::memcpy(&s, newest, sizeof(s));
+    return true;
+}
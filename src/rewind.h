@@ -0,0 +1,63 @@
+/*
+ *
+ * CHIPIT
+ *
+ * Rewind buffer: a history of machine states in a fixed amount of memory.
+ *
+ * Only the newest state is kept as is. Every older one is stored as the
+ * difference to the state after it: the two are XORed, and the result (mostly
+ * zeros, since little of RAM changes from one frame to the next) is run length
+ * encoded in 64-bit words. The encoded deltas live in a ring buffer; when it's
+ * full the oldest ones are dropped.
+ */
+
+#ifndef REWIND_H
+#define REWIND_H
+
+#include <deque>
+#include <vector>
+
+#include "machine.h"
+
+class Rewind {
+    public:
+        // budget is the size of the delta buffer in bytes
+        explicit Rewind(size_t budget);
+
+        // Record s as the newest state
+        void push(const MachineState &s);
+
+        // Go back one state: s becomes the state pushed before the newest one,
+        // which becomes the newest itself. Returns false if there's no older state.
+        bool pop(MachineState &s);
+
+        void clear();
+
+        // Number of times pop() can go back
+        size_t depth() const { return entries.size(); }
+
+        size_t budget() const { return buffer.size(); }
+        size_t used() const;
+
+    private:
+        static const size_t stateWords = (sizeof(MachineState) + 7) / 8;
+
+        bool allocate(size_t size);
+        size_t encode(const u64 *a, const u64 *b, u64 *out);
+        void decode(const u64 *in, u64 *state);
+
+        struct Entry {
+            size_t offset;       // in words
+            size_t size;
+        };
+
+        std::vector<u64> buffer;
+        std::deque<Entry> entries;
+        size_t writePos;         // where the next entry goes, in words
+
+        bool haveNewest;
+        u64 newest[stateWords];
+        u64 scratch[2 * stateWords + 2];
+};
+
+#endif
@@ -0,0 +1,473 @@
+/*
+ *
+ * CHIPIT
+ *
+ * Opcode dispatch tables. See table.h. Like the predecoded handlers, these
+ * must behave exactly like the corresponding cases in
+ * Machine::executeOpcode().
+ */
+
+#include <utility>
+
+#include "machine.h"
+#include "table.h"
+
+// 0nnn - Call RCA 1802 program. Not implemented. Also used for unknown opcodes.
+static int opNop(Machine &m, u16 opcode)
+{
+    return 2;
+}
+
+// 00E0 - Clear the screen
+static int op00E0(Machine &m, u16 opcode)
+{
+    m.clearDisplay();
+    return 2;
+}
+
+// 00EE - Return from subroutine
+static int op00EE(Machine &m, u16 opcode)
+{
+    m.stackptr = (m.stackptr - 1) & 0xF;
+    m.pc = m.stack[m.stackptr];
+    return 2;
+}
+
+// 00Cn - Scroll down n pixels
+static int op00Cn(Machine &m, u16 opcode)
+{
+    m.scrollDown(opcode & 0xF);
+    return 2;
+}
+
+// 00Dn - Scroll up n pixels
+static int op00Dn(Machine &m, u16 opcode)
+{
+    m.scrollUp(opcode & 0xF);
+    return 2;
+}
+
+// 00FB - Scroll right 4 pixels
+static int op00FB(Machine &m, u16 opcode)
+{
+    m.scrollRight();
+    return 2;
+}
+
+// 00FC - Scroll left 4 pixels
+static int op00FC(Machine &m, u16 opcode)
+{
+    m.scrollLeft();
+    return 2;
+}
+
+// 00FD - Exit. Stays on this instruction for good.
+static int op00FD(Machine &m, u16 opcode)
+{
+    return 0;
+}
+
+// 00FE - Low resolution
+static int op00FE(Machine &m, u16 opcode)
+{
+    m.setHires(false);
+    return 2;
+}
+
+// 00FF - High resolution
+static int op00FF(Machine &m, u16 opcode)
+{
+    m.setHires(true);
+    return 2;
+}
+
+// 1nnn - Jump to address nnn
+static int op1nnn(Machine &m, u16 opcode)
+{
+    m.pc = opcode & 0xFFF;
+    return 0;
+}
+
+// 2nnn - Call subroutine at nnn
+static int op2nnn(Machine &m, u16 opcode)
+{
+    m.stack[m.stackptr] = m.pc;
+    m.stackptr = (m.stackptr + 1) & 0xF;
+    m.pc = opcode & 0xFFF;
+    return 0;
+}
+
+// Annn - I = nnn
+static int opAnnn(Machine &m, u16 opcode)
+{
+    m.I = opcode & 0xFFF;
+    return 2;
+}
+
+// Fn01 - Select the planes n to draw to
+static int opFn01(Machine &m, u16 opcode)
+{
+    m.display.planes = (opcode >> 8) & 3;
+    return 2;
+}
+
+// Fx0A - Wait for keypress. Stays on this instruction until a key is down.
+static int opFx0A(Machine &m, u16 opcode)
+{
+    for (int i = 0; i < 16; i++) {
+        if (m.key[i]) {
+            m.v[0x0] = i;
+            return 2;
+        }
+    }
+    return 0;
+}
+
+// The handlers with register operands are instantiated for every register
+// (or pair of registers), as the run() of a class template so they can be
+// passed on as template template parameters.
+
+// 3xkk - Skip next instruction if Vx == kk
+template <int X> struct Op3xkk {
+    static int run(Machine &m, u16 opcode) { return m.v[X] == (opcode & 0xFF) ? 4 : 2; }
+};
+
+// 4xkk - Skip next instruction if Vx != kk
+template <int X> struct Op4xkk {
+    static int run(Machine &m, u16 opcode) { return m.v[X] != (opcode & 0xFF) ? 4 : 2; }
+};
+
+// 5xy0 - Skip next instruction if Vx == Vy
+template <int X, int Y> struct Op5xy0 {
+    static int run(Machine &m, u16 opcode) { return m.v[X] == m.v[Y] ? 4 : 2; }
+};
+
+// 6xkk - Vx = kk
+template <int X> struct Op6xkk {
+    static int run(Machine &m, u16 opcode) { m.v[X] = opcode & 0xFF; return 2; }
+};
+
+// 7xkk - Vx += kk
+template <int X> struct Op7xkk {
+    static int run(Machine &m, u16 opcode) { m.v[X] += opcode & 0xFF; return 2; }
+};
+
+// 8xy0 - Vx = Vy
+template <int X, int Y> struct Op8xy0 {
+    static int run(Machine &m, u16 opcode) { m.v[X] = m.v[Y]; return 2; }
+};
+
+// 8xy1 - Vx |= Vy
+template <int X, int Y> struct Op8xy1 {
+    static int run(Machine &m, u16 opcode) { m.v[X] |= m.v[Y]; return 2; }
+};
+
+// 8xy2 - Vx &= Vy
+template <int X, int Y> struct Op8xy2 {
+    static int run(Machine &m, u16 opcode) { m.v[X] &= m.v[Y]; return 2; }
+};
+
+// 8xy3 - Vx ^= Vy
+template <int X, int Y> struct Op8xy3 {
+    static int run(Machine &m, u16 opcode) { m.v[X] ^= m.v[Y]; return 2; }
+};
+
+// 8xy4 - Vx += Vy, VF = carry
+template <int X, int Y> struct Op8xy4 {
+    static int run(Machine &m, u16 opcode)
+    {
+        m.v[0xF] = (m.v[X] + m.v[Y]) > 0xFF;
+        m.v[X] += m.v[Y];
+        return 2;
+    }
+};
+
+// 8xy5 - Vx -= Vy, VF = not borrow
+template <int X, int Y> struct Op8xy5 {
+    static int run(Machine &m, u16 opcode)
+    {
+        m.v[0xF] = m.v[X] > m.v[Y];
+        m.v[X] -= m.v[Y];
+        return 2;
+    }
+};
+
+// 8xy7 - Vx = Vy - Vx, VF = not borrow
+template <int X, int Y> struct Op8xy7 {
+    static int run(Machine &m, u16 opcode)
+    {
+        m.v[0xF] = !(m.v[X] > m.v[Y]);
+        m.v[X] = m.v[Y] - m.v[X];
+        return 2;
+    }
+};
+
+// 9xy0 - Skip next instruction if Vx != Vy
+template <int X, int Y> struct Op9xy0 {
+    static int run(Machine &m, u16 opcode) { return m.v[X] != m.v[Y] ? 4 : 2; }
+};
+
+// Cxkk - Vx = random number
+template <int X> struct OpCxkk {
+    static int run(Machine &m, u16 opcode)
+    {
+        m.v[X] = m.nextRandom() % ((opcode & 0xFF) + 1);
+        return 2;
+    }
+};
+
+// Ex9E - Skip next instruction if key Vx is pressed
+template <int X> struct OpEx9E {
+    static int run(Machine &m, u16 opcode) { return m.key[m.v[X] & 0xF] ? 4 : 2; }
+};
+
+// ExA1 - Skip next instruction if key Vx is not pressed
+template <int X> struct OpExA1 {
+    static int run(Machine &m, u16 opcode) { return m.key[m.v[X] & 0xF] ? 2 : 4; }
+};
+
+// Fx07 - Vx = delay timer
+template <int X> struct OpFx07 {
+    static int run(Machine &m, u16 opcode) { m.v[X] = m.delaytimer; return 2; }
+};
+
+// Fx15 - delay timer = Vx
+template <int X> struct OpFx15 {
+    static int run(Machine &m, u16 opcode) { m.delaytimer = m.v[X]; return 2; }
+};
+
+// Fx18 - sound timer = Vx
+template <int X> struct OpFx18 {
+    static int run(Machine &m, u16 opcode) { m.soundtimer = m.v[X]; return 2; }
+};
+
+// Fx1E - I += Vx
+template <int X> struct OpFx1E {
+    static int run(Machine &m, u16 opcode) { m.I += m.v[X]; return 2; }
+};
+
+// Fx29 - I = location of font sprite for Vx
+template <int X> struct OpFx29 {
+    static int run(Machine &m, u16 opcode) { m.I = m.v[X] * 5; return 2; }
+};
+
+// Fx30 - I = location of big font sprite for Vx
+template <int X> struct OpFx30 {
+    static int run(Machine &m, u16 opcode) { m.I = bigFontAddr + (m.v[X] & 0xF) * 10; return 2; }
+};
+
+// Fx33 - Store BCD of Vx at I, I+1, I+2
+template <int X> struct OpFx33 {
+    static int run(Machine &m, u16 opcode)
+    {
+        u8 vx = m.v[X];
+        m.writeRam(m.I + 0, vx / 100);
+        m.writeRam(m.I + 1, (vx / 10) % 10);
+        m.writeRam(m.I + 2, vx % 10);
+        return 2;
+    }
+};
+
+// Fx75 - Store V0 - Vx in the user flags
+template <int X> struct OpFx75 {
+    static int run(Machine &m, u16 opcode)
+    {
+        for (int r = 0; r <= X; r++)
+            m.flags[r] = m.v[r];
+        return 2;
+    }
+};
+
+// Fx85 - Load V0 - Vx from the user flags
+template <int X> struct OpFx85 {
+    static int run(Machine &m, u16 opcode)
+    {
+        for (int r = 0; r <= X; r++)
+            m.v[r] = m.flags[r];
+        return 2;
+    }
+};
+
+// The handlers of the instructions with quirks, for every profile
+template <class Q> struct QuirkOps {
+    // 8xy6 - Vx >>= 1, VF = LSB of Vx before the shift (Vy with the shift quirk)
+    template <int X, int Y> struct Op8xy6 {
+        static int run(Machine &m, u16 opcode)
+        {
+            m.v[0xF] = m.v[Q::shiftVy ? Y : X] & 1;
+            m.v[X] = m.v[Q::shiftVy ? Y : X] >> 1;
+            return 2;
+        }
+    };
+
+    // 8xyE - Vx <<= 1, VF = MSB of Vx before the shift (Vy with the shift quirk)
+    template <int X, int Y> struct Op8xyE {
+        static int run(Machine &m, u16 opcode)
+        {
+            m.v[0xF] = m.v[Q::shiftVy ? Y : X] >> 7;
+            m.v[X] = m.v[Q::shiftVy ? Y : X] << 1;
+            return 2;
+        }
+    };
+
+    // Bnnn - Jump to nnn + V0, or to xnn + Vx with the jump quirk
+    template <int X> struct OpBnnn {
+        static int run(Machine &m, u16 opcode)
+        {
+            m.pc = m.v[Q::jumpVx ? X : 0x0] + (opcode & 0xFFF);
+            return 0;
+        }
+    };
+
+    // Dxyn - Draw sprite, 16x16 if n is 0
+    template <int X, int Y> struct OpDxyn {
+        static int run(Machine &m, u16 opcode) { m.drawSprite<Q>(X, Y, opcode & 0xF); return 2; }
+    };
+
+    // Fx55 - Store V0 - Vx at I, I += x + 1 unless the load/store quirk keeps I
+    template <int X> struct OpFx55 {
+        static int run(Machine &m, u16 opcode)
+        {
+            for (int r = 0; r <= X; r++)
+                m.writeRam(m.I + r, m.v[r]);
+            if (!Q::keepI)
+                m.I += X + 1;
+            return 2;
+        }
+    };
+
+    // Fx65 - Load V0 - Vx from I, I += x + 1 unless the load/store quirk keeps I
+    template <int X> struct OpFx65 {
+        static int run(Machine &m, u16 opcode)
+        {
+            for (int r = 0; r <= X; r++)
+                m.v[r] = m.ram[(m.I + r) & 0xFFF];
+            if (!Q::keepI)
+                m.I += X + 1;
+            return 2;
+        }
+    };
+};
+
+// The instantiations of a handler, indexed by x or by (x << 4 | y)
+struct ByX {
+    TableHandler fn[16];
+};
+
+struct ByXY {
+    TableHandler fn[256];
+};
+
+template <template <int> class Op, std::size_t... I>
+constexpr ByX instantiate(std::index_sequence<I...>)
+{
+    return ByX{ { &Op<I>::run... } };
+}
+
+template <template <int, int> class Op, std::size_t... I>
+constexpr ByXY instantiate(std::index_sequence<I...>)
+{
+    return ByXY{ { &Op<(I >> 4), (I & 0xF)>::run... } };
+}
+
+template <template <int> class Op>
+constexpr ByX byX = instantiate<Op>(std::make_index_sequence<16>());
+
+template <template <int, int> class Op>
+constexpr ByXY byXY = instantiate<Op>(std::make_index_sequence<256>());
+
+// The handler for an opcode, picked the way executeOpcode() does
+template <class Q>
+static constexpr TableHandler handler(u16 opcode)
+{
+    typedef QuirkOps<Q> Ops;
+
+    int x = (opcode >> 8) & 0xF;
+    int xy = (opcode >> 4) & 0xFF;
+
+    switch (opcode >> 12) {
+        case 0x0:
+            if (opcode == 0x00E0)
+                return op00E0;
+            if (opcode == 0x00EE)
+                return op00EE;
+            if ((opcode & 0xFFF0) == 0x00C0)
+                return op00Cn;
+            if ((opcode & 0xFFF0) == 0x00D0)
+                return op00Dn;
+            switch (opcode) {
+                case 0x00FB: return op00FB;
+                case 0x00FC: return op00FC;
+                case 0x00FD: return op00FD;
+                case 0x00FE: return op00FE;
+                case 0x00FF: return op00FF;
+                default: return opNop;
+            }
+        case 0x1: return op1nnn;
+        case 0x2: return op2nnn;
+        case 0x3: return byX<Op3xkk>.fn[x];
+        case 0x4: return byX<Op4xkk>.fn[x];
+        case 0x5: return byXY<Op5xy0>.fn[xy];
+        case 0x6: return byX<Op6xkk>.fn[x];
+        case 0x7: return byX<Op7xkk>.fn[x];
+        case 0x8:
+            switch (opcode & 0xF) {
+                case 0x0: return byXY<Op8xy0>.fn[xy];
+                case 0x1: return byXY<Op8xy1>.fn[xy];
+                case 0x2: return byXY<Op8xy2>.fn[xy];
+                case 0x3: return byXY<Op8xy3>.fn[xy];
+                case 0x4: return byXY<Op8xy4>.fn[xy];
+                case 0x5: return byXY<Op8xy5>.fn[xy];
+                case 0x6: return byXY<Ops::template Op8xy6>.fn[xy];
+                case 0x7: return byXY<Op8xy7>.fn[xy];
+                case 0xE: return byXY<Ops::template Op8xyE>.fn[xy];
+                default: return opNop;
+            }
+        case 0x9: return byXY<Op9xy0>.fn[xy];
+        case 0xA: return opAnnn;
+        case 0xB: return byX<Ops::template OpBnnn>.fn[x];
+        case 0xC: return byX<OpCxkk>.fn[x];
+        case 0xD: return byXY<Ops::template OpDxyn>.fn[xy];
+        case 0xE:
+            if ((opcode & 0xFF) == 0x9E)
+                return byX<OpEx9E>.fn[x];
+            if ((opcode & 0xFF) == 0xA1)
+                return byX<OpExA1>.fn[x];
+            return opNop;
+        default:
+            switch (opcode & 0xFF) {
+                case 0x01: return opFn01;
+                case 0x07: return byX<OpFx07>.fn[x];
+                case 0x0A: return opFx0A;
+                case 0x15: return byX<OpFx15>.fn[x];
+                case 0x18: return byX<OpFx18>.fn[x];
+                case 0x1E: return byX<OpFx1E>.fn[x];
+                case 0x29: return byX<OpFx29>.fn[x];
+                case 0x30: return byX<OpFx30>.fn[x];
+                case 0x33: return byX<OpFx33>.fn[x];
+                case 0x55: return byX<Ops::template OpFx55>.fn[x];
+                case 0x65: return byX<Ops::template OpFx65>.fn[x];
+                case 0x75: return byX<OpFx75>.fn[x];
+                case 0x85: return byX<OpFx85>.fn[x];
+                default: return opNop;
+            }
+    }
+}
+
+template <class Q>
+static constexpr OpcodeTable build()
+{
+    OpcodeTable t = {};
+    for (int opcode = 0; opcode < 65536; opcode++)
+        t.fn[opcode] = handler<Q>(opcode);
+    return t;
+}
+
+// Evaluated by the compiler: the whole tables end up in the binary as is
+extern const OpcodeTable opcodeTables[quirkProfiles];
+constexpr OpcodeTable opcodeTables[quirkProfiles] = {
+    build<ModernQuirks>(),
+    build<CosmacQuirks>(),
+    build<SchipQuirks>(),
+    build<XochipQuirks>(),
+};
@@ -0,0 +1,40 @@
+/*
+ *
+ * CHIPIT
+ *
+ * Opcode dispatch table (--engine table).
+ *
+ * An opcode table has an entry for every one of the 65536 opcodes, pointing
+ * straight at a handler for it, so executing an instruction is one load and
+ * one indirect call, without the branches of executeOpcode() and without the
+ * cache of the predecode engine. The handlers are templates with the register
+ * numbers as parameters, and the table is built at compile time. Operands
+ * that would need too many instantiations (kk, nnn and the sprite height) are
+ * taken from the opcode at run time. There's a table for every quirk profile
+ * (see quirks.h).
+ *
+ * It's mostly there as a baseline for the other engines: the cost of dispatch
+ * alone, with nothing cached.
+ */
+
+#ifndef TABLE_H
+#define TABLE_H
+
+#include <stdint.h>
+
+#include "quirks.h"
+
+class Machine;
+
+// Executes the given opcode, which is the one at PC. Returns how much PC
+// should be advanced, just like Machine::executeOpcode().
+typedef int (*TableHandler)(Machine &m, uint16_t opcode);
+
+struct OpcodeTable {
+    TableHandler fn[65536];
+};
+
+// Indexed by Quirks
+extern const OpcodeTable opcodeTables[quirkProfiles];
+
+#endif
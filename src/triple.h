@@ -0,0 +1,62 @@
+/*
+ *
+ * CHIPIT
+ *
+ * Lock-free triple buffer for handing data from one thread to another.
+ *
+ * The writer fills the back slot and publishes it, the reader picks up the
+ * most recently published one. Neither ever waits for the other: publishing
+ * swaps the back slot with the middle one, fetching swaps the middle one with
+ * the front. If the writer publishes faster than the reader fetches, the
+ * frames in between are dropped.
+ */
+
+#ifndef TRIPLE_H
+#define TRIPLE_H
+
+#include <atomic>
+#include <stdint.h>
+
+template <typename T>
+class TripleBuffer {
+    public:
+        TripleBuffer() : middle(1), back(0), front(2) {}
+
+        // Writer: the slot to fill
+        T &writeBuffer() { return slots[back]; }
+
+        // Writer: make the write buffer the latest one. Afterwards the write
+        // buffer is the previously published slot; returns true if the
+        // reader never saw that one.
+        bool publish()
+        {
+            uint8_t old = middle.exchange(back | fresh, std::memory_order_acq_rel);
+            back = old & 3;
+            return old & fresh;
+        }
+
+        // Reader: pick up the latest slot, if one was published since the
+        // last call. Returns false if there's nothing new.
+        bool fetch()
+        {
+            if (!(middle.load(std::memory_order_relaxed) & fresh))
+                return false;
+            uint8_t old = middle.exchange(front, std::memory_order_acq_rel);
+            front = old & 3;
+            return true;
+        }
+
+        // Reader: the slot picked up by the last fetch()
+        const T &readBuffer() const { return slots[front]; }
+
+    private:
+        // Set in middle when it holds a slot the reader hasn't fetched yet
+        static const uint8_t fresh = 4;
+
+        T slots[3];
+        std::atomic<uint8_t> middle;
+        uint8_t back;        // only used by the writer
+        uint8_t front;       // only used by the reader
+};
+
+#endif
@@ -0,0 +1,123 @@
+/*
+ *
+ * CHIPIT
+ *
+ * Video recording. See video.h.
+ */
+
+#include <chrono>
+#include <cstring>
+
+#include "video.h"
+
+VideoRecorder::VideoRecorder(int scale, size_t slots)
+    : scale(scale), ring(slots), head(0), tail(0), stopping(false), file(nullptr), header(false),
+      failed(false), droppedFrames(0), writtenFrames(0)
+{
+}
+
+VideoRecorder::~VideoRecorder()
+{
+    close();
+}
+
+bool VideoRecorder::open(const char *path)
+{
+    size_t length = std::strlen(path);
+    header = length >= 4 && std::strcmp(path + length - 4, ".y4m") == 0;
+
+    file = fopen(path, "wb");
+    if (!file)
+        return false;
+
+    // The pixels are shades of grey, luma only is enough
+    if (header)
+        failed = fprintf(file, "YUV4MPEG2 W%d H%d F60:1 Ip A1:1 Cmono\n", width(), height()) < 0;
+
+    pixels.resize((size_t)width() * height());
+    writer = std::thread(&VideoRecorder::write, this);
+    return true;
+}
+
+bool VideoRecorder::push(const Framebuffer &fb, bool wait)
+{
+    if (!file)
+        return false;
+
+    uint64_t h = head.load(std::memory_order_relaxed);
+    while (h - tail.load(std::memory_order_acquire) == ring.size()) {
+        if (!wait) {
+            droppedFrames++;
+            return false;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    ring[h % ring.size()] = fb;
+    head.store(h + 1, std::memory_order_release);
+    return true;
+}
+
+bool VideoRecorder::close()
+{
+    if (!file)
+        return !failed;
+
+    stopping.store(true, std::memory_order_release);
+    writer.join();
+    if (fclose(file) != 0)
+        failed = true;
+    file = nullptr;
+    return !failed;
+}
+
+// Grey levels of fb into out, width() x height(), each pixel of fb a square
+// of scale x scale. Every line is worked out once and copied for the others.
+void VideoRecorder::expand(const Framebuffer &fb, uint8_t *out) const
+{
+    const int w = width();
+    for (int y = 0; y < Framebuffer::height; y++) {
+        Framebuffer::Row plane0 = fb.row(0, y);
+        Framebuffer::Row plane1 = fb.row(1, y);
+        uint8_t *line = out + (size_t)y * scale * w;
+        uint8_t *p = line;
+        for (int x = 0; x < Framebuffer::width; x++, plane0 <<= 1, plane1 <<= 1) {
+            uint8_t c = Framebuffer::shade((int)(plane0 >> (Framebuffer::width - 1)) |
+                    (int)(plane1 >> (Framebuffer::width - 1)) << 1);
+            for (int i = 0; i < scale; i++)
+                *p++ = c;
+        }
+        for (int i = 1; i < scale; i++)
+            std::memcpy(line + (size_t)i * w, line, w);
+    }
+}
+
+// The writer thread. A slot is given back as soon as its frame is expanded,
+// before it's written. Once stopping is set, whatever was pushed before is
+// still written.
+void VideoRecorder::write()
+{
+    for (;;) {
+        bool stop = stopping.load(std::memory_order_acquire);
+        uint64_t t = tail.load(std::memory_order_relaxed);
+        if (t == head.load(std::memory_order_acquire)) {
+            if (stop)
+                break;
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            continue;
+        }
+
+        if (!failed)
+            expand(ring[t % ring.size()], pixels.data());
+        tail.store(t + 1, std::memory_order_release);
+
+        if (failed)
+            continue;
+        if (header && fputs("FRAME\n", file) == EOF)
+            failed = true;
+        else if (fwrite(pixels.data(), 1, pixels.size(), file) != pixels.size())
+            failed = true;
+        else
+            writtenFrames++;
+    }
+}
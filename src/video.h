@@ -0,0 +1,80 @@
+/*
+ *
+ * CHIPIT
+ *
+ * Video recording (--record): every frame of the program, written to a file
+ * as it runs.
+ *
+ * The emulation thread only copies the framebuffer (2 KB) into the next slot
+ * of a ring allocated up front, and goes on. A writer thread of its own takes
+ * the frames out of the ring in order, expands them to grey pixels, scaled up
+ * if asked to, and writes them to the file, so neither the conversion nor the
+ * disk ever hold up the program. The ring is a single producer, single
+ * consumer queue with a counter for each side; neither side takes a lock.
+ *
+ * A file whose name ends in .y4m gets YUV4MPEG2, which video players and
+ * encoders read as is (e.g. ffmpeg -i out.y4m out.mp4). Anything else, such
+ * as a pipe, gets the raw frames one after the other, 8-bit grey, at 60
+ * frames per second.
+ */
+
+#ifndef VIDEO_H
+#define VIDEO_H
+
+#include <stdio.h>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "framebuffer.h"
+
+class VideoRecorder {
+    public:
+        // scale is the size of a framebuffer pixel in the video, in pixels in
+        // either direction; slots is the number of frames the ring holds
+        explicit VideoRecorder(int scale = 1, size_t slots = 256);
+        // Finishes the file if close() wasn't called
+        ~VideoRecorder();
+
+        // Create the file, write the header and start the writer. Returns
+        // false if the file can't be created.
+        bool open(const char *path);
+
+        // Emulation thread: queue a frame. If the writer is a whole ring
+        // behind, wait for it when told to (headless runs, where every frame
+        // counts more than the time), or drop the frame and return false.
+        bool push(const Framebuffer &fb, bool wait);
+
+        // Write what's left in the ring, stop the writer and close the file.
+        // Returns false if anything couldn't be written.
+        bool close();
+
+        int width() const { return Framebuffer::width * scale; }
+        int height() const { return Framebuffer::height * scale; }
+        bool y4m() const { return header; }
+
+        // Frames dropped by push(), and written to the file (once closed)
+        uint64_t dropped() const { return droppedFrames; }
+        uint64_t written() const { return writtenFrames; }
+
+    private:
+        void expand(const Framebuffer &fb, uint8_t *out) const;
+        void write();
+
+        const int scale;
+        std::vector<Framebuffer> ring;
+        std::atomic<uint64_t> head;     // frames pushed, only written by push()
+        std::atomic<uint64_t> tail;     // frames taken out, only written by write()
+        std::atomic<bool> stopping;
+
+        FILE *file;
+        bool header;                    // YUV4MPEG2 rather than raw frames
+        bool failed;                    // a write failed, frames are skipped from then on
+        uint64_t droppedFrames;         // only used by push()
+        uint64_t writtenFrames;         // only used by the writer
+        std::vector<uint8_t> pixels;    // of the frame being written
+        std::thread writer;
+};
+
+#endif